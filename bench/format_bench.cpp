@@ -0,0 +1,111 @@
+/*
+ * LogFormatter benchmark: compiled opcode path vs. FormatItem path.
+ * Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ * usage: bench_format [iterations] [pattern]
+ */
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include "log.hpp"
+
+// count heap allocations made while formatting
+static std::atomic<uint64_t> s_allocs(0);
+
+void* operator new(size_t size) {
+    ++s_allocs;
+    void* p = malloc(size);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+using namespace sylar;
+
+template<class F>
+void run(const std::string& name, int iterations, F func) {
+    size_t bytes = 0;
+    // warm up buffers
+    for (int i = 0; i < 1000; ++i) {
+        bytes += func();
+    }
+    bytes = 0;
+    uint64_t allocs = s_allocs;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        bytes += func();
+    }
+    auto end = std::chrono::steady_clock::now();
+    allocs = s_allocs - allocs;
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout << name 
+              << "\tns/op=" << ns / iterations 
+              << "\tallocs/op=" << (double)allocs / iterations 
+              << "\tbytes/op=" << bytes / iterations 
+              << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+    std::string pattern = argc > 2 ? argv[2] : "%d%T[%p]%T<%f:%l>%T%t%T%m%n";
+
+    Logger::ptr logger(new Logger("bench"));
+    LogFormatter::ptr formatter(new LogFormatter(pattern));
+    LogEvent::ptr event(new LogEvent(logger, LogLevel::INFO, __FILE__, __LINE__, 
+                                     GetThreadID(), GetFiberID(), 0, time(0)));
+    event->getSS() << "benchmark message with some payload " << 12345;
+
+    std::cout << "pattern: " << pattern << std::endl;
+    // what LogFormatter::format did before: one stringstream per event
+    run("FormatItem", iterations, [&]() {
+        std::stringstream ss;
+        formatter->format(ss, logger, event);
+        return ss.str().size();
+    });
+    run("compiled", iterations, [&]() {
+        return formatter->formatLocal(logger, event).size();
+    });
+    // the same fields as structured lines
+    LogFormatter::ptr json(new LogFormatter(pattern, LogFormatter::STYLE_JSON));
+    run("json", iterations, [&]() {
+        return json->formatLocal(logger, event).size();
+    });
+    LogFormatter::ptr logfmt(new LogFormatter(pattern, LogFormatter::STYLE_LOGFMT));
+    run("logfmt", iterations, [&]() {
+        return logfmt->formatLocal(logger, event).size();
+    });
+
+    // message formatting on pooled events, Acquire/Release cost is in every case
+    std::string name = "benchmark";
+    // what LogEvent::format did before
+    run("vasprintf", iterations, [&]() {
+        LogEvent::ptr e = LogEvent::Acquire(logger, LogLevel::INFO, __FILE__, __LINE__, 0, 0, 0);
+        char* buf = nullptr;
+        int len = asprintf(&buf, "user %s id=%d took %f ms", name.c_str(), 12345, 3.25);
+        e->getSS() << std::string(buf, len);
+        free(buf);
+        size_t size = e->getContentSize();
+        LogEvent::Release(e);
+        return size;
+    });
+    run("format", iterations, [&]() {
+        LogEvent::ptr e = LogEvent::Acquire(logger, LogLevel::INFO, __FILE__, __LINE__, 0, 0, 0);
+        e->format("user %s id=%d took %f ms", name.c_str(), 12345, 3.25);
+        size_t size = e->getContentSize();
+        LogEvent::Release(e);
+        return size;
+    });
+    run("formatx", iterations, [&]() {
+        LogEvent::ptr e = LogEvent::Acquire(logger, LogLevel::INFO, __FILE__, __LINE__, 0, 0, 0);
+        e->formatx("user {} id={} took {} ms", name, 12345, 3.25);
+        size_t size = e->getContentSize();
+        LogEvent::Release(e);
+        return size;
+    });
+    return 0;
+}
@@ -0,0 +1,42 @@
+/*
+ * Cost of log statements which do not log.
+ * Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ * usage: bench_level [iterations]
+ */
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include "log.hpp"
+
+using namespace sylar;
+
+template<class F>
+void run(const std::string& name, int iterations, F func) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        func(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    std::cout << name << "\tns/op=" << ns / iterations << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 100000000;
+
+    Logger::ptr logger(new Logger("bench"));
+    logger->setLevel(LogLevel::ERROR);
+
+    std::cout << "SYLAR_LOG_MIN_LEVEL=" << SYLAR_LOG_MIN_LEVEL << std::endl;
+    run("empty loop", iterations, [&](int i) {
+        asm volatile("" : : "r"(i));
+    });
+    // below the logger's level: one atomic load and a compare
+    run("disabled <<", iterations, [&](int i) {
+        SYLAR_LOG_DEBUG(logger) << "disabled " << i;
+    });
+    run("disabled fmt", iterations, [&](int i) {
+        SYLAR_LOG_FMT_DEBUG(logger, "disabled %d", i);
+    });
+    return 0;
+}
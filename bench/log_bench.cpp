@@ -0,0 +1,282 @@
+/*
+ * Logger benchmark: throughput and per-call latency of SYLAR_LOG_INFO.
+ * Runs every combination of thread count (1, 2, 4 ... cores), appender
+ * (null, stdout, file) and pattern, with the level enabled, plus one
+ * disabled run per thread count. Each case logs the same number of lines
+ * per thread; throughput counts until the appender is flushed.
+ * Latencies include two clock_gettime() calls, the disabled case shows 
+ * about what they cost.
+ * Results are written one JSON object per line (default bench_log.json),
+ * a summary goes to stderr. Redirect stdout for the stdout appender cases,
+ * they are skipped when stdout is a terminal unless -a names them.
+ * Build with -DCMAKE_BUILD_TYPE=Release for meaningful numbers.
+ * usage: bench_log [-n lines per thread] [-t max threads] [-a null,stdout,file]
+ *                  [-p simple,default,full] [-f log file] [-o result file]
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <time.h>
+#include "log.hpp"
+
+using namespace sylar;
+
+static uint64_t NowNS() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// formats like any appender and drops the result
+class NullLogAppender : public LogAppender {
+public:
+    virtual void log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) override {
+        m_bytes.fetch_add(m_formatter->formatLocal(logger_ptr, event).size(), std::memory_order_relaxed);
+    }
+    virtual void write (const std::string& msg) override {
+        m_bytes.fetch_add(msg.size(), std::memory_order_relaxed);
+    }
+    virtual std::string toYamlString() override { return "type: NullLogAppender"; }
+    virtual void setFormatter (const std::string& pattern) override {
+        m_formatter.reset(new LogFormatter(pattern));
+    }
+    uint64_t getBytes () const { return m_bytes; }
+private:
+    std::atomic<uint64_t> m_bytes{0};
+};
+
+struct Case {
+    std::string appender;
+    std::string pattern_name;
+    std::string pattern;
+    bool enabled;
+    int threads;
+};
+
+struct Result {
+    double seconds;
+    uint64_t lines;
+    uint64_t bytes;
+    // per-call latency in ns
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+static std::vector<std::string> Split(const std::string& str) {
+    std::vector<std::string> vec;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            vec.push_back(item);
+        }
+    }
+    return vec;
+}
+
+static Result Run(const Case& c, int lines, const std::string& filename) {
+    Logger::ptr logger(new Logger("bench"));
+    logger->setLevel(c.enabled ? LogLevel::DEBUG : LogLevel::ERROR);
+    LogAppender::ptr appender;
+    std::shared_ptr<NullLogAppender> null_appender;
+    if (c.appender == "null") {
+        null_appender.reset(new NullLogAppender);
+        appender = null_appender;
+    }
+    else if (c.appender == "stdout") {
+        appender.reset(new StdoutLogAppender);
+    }
+    else {
+        unlink(filename.c_str());
+        appender.reset(new FileLogAppender(filename));
+    }
+    appender->setFormatter(c.pattern);
+    logger->addAppender(appender);
+
+    // start every thread at once
+    std::atomic<int> ready(0);
+    std::atomic<bool> go(false);
+    std::vector<std::vector<uint32_t> > latencies(c.threads);
+    std::vector<Thread::ptr> threads;
+    for (int t = 0; t < c.threads; ++t) {
+        std::vector<uint32_t>& lat = latencies[t];
+        lat.resize(lines);
+        threads.push_back(Thread::ptr(new Thread([&, t]() {
+            ++ready;
+            while (!go.load(std::memory_order_acquire)) {
+                sched_yield();
+            }
+            for (int i = 0; i < lines; ++i) {
+                uint64_t begin = NowNS();
+                SYLAR_LOG_INFO(logger) << "bench message " << i << " from thread " << t << " value " << 3.25;
+                lat[i] = NowNS() - begin;
+            }
+        }, "bench_" + std::to_string(t))));
+    }
+    while (ready < c.threads) {
+        sched_yield();
+    }
+    uint64_t start = NowNS();
+    go.store(true, std::memory_order_release);
+    for (auto& thr : threads) {
+        thr->join();
+    }
+    appender->flush();
+    uint64_t end = NowNS();
+
+    Result r;
+    r.seconds = (end - start) / 1e9;
+    r.lines = (uint64_t)lines * c.threads;
+    r.bytes = 0;
+    if (null_appender) {
+        r.bytes = null_appender->getBytes();
+    }
+    else if (c.appender == "file") {
+        logger->clearAppender();
+        appender.reset();   // closes the file
+        std::ifstream ifs(filename, std::ios::binary | std::ios::ate);
+        r.bytes = ifs ? (uint64_t)ifs.tellg() : 0;
+        unlink(filename.c_str());
+    }
+    else {
+        // stdout: the length of one formatted sample line
+        LogEvent::ptr event(new LogEvent(logger, LogLevel::INFO, __FILE__, __LINE__,
+                                         GetThreadID(), GetFiberID(), 0, time(0)));
+        event->getSS() << "bench message " << lines / 2 << " from thread " << 0 << " value " << 3.25;
+        r.bytes = appender->getFormatter()->formatLocal(logger, event).size() * r.lines;
+    }
+
+    std::vector<uint32_t> all;
+    all.reserve(r.lines);
+    for (auto& lat : latencies) {
+        all.insert(all.end(), lat.begin(), lat.end());
+    }
+    auto percentile = [&all](double q) -> uint64_t {
+        size_t k = std::min(all.size() - 1, (size_t)(q * all.size()));
+        std::nth_element(all.begin(), all.begin() + k, all.end());
+        return all[k];
+    };
+    r.p50 = percentile(0.50);
+    r.p99 = percentile(0.99);
+    r.p999 = percentile(0.999);
+    r.max = *std::max_element(all.begin(), all.end());
+    return r;
+}
+
+int main(int argc, char* argv[]) {
+    int lines = 200000;
+    int max_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::string appenders = "null,stdout,file";
+    std::string patterns = "simple,default,full";
+    std::string filename = "bench_log.txt";
+    std::string output = "bench_log.json";
+    bool appenders_given = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:a:p:f:o:")) != -1) {
+        switch (opt) {
+            case 'n': lines = atoi(optarg); break;
+            case 't': max_threads = atoi(optarg); break;
+            case 'a': appenders = optarg; appenders_given = true; break;
+            case 'p': patterns = optarg; break;
+            case 'f': filename = optarg; break;
+            case 'o': output = optarg; break;
+            default:
+                std::cerr << "usage: " << argv[0] << " [-n lines per thread] [-t max threads]"
+                          << " [-a null,stdout,file] [-p simple,default,full]"
+                          << " [-f log file] [-o result file]" << std::endl;
+                return 1;
+        }
+    }
+    if (lines <= 0 || max_threads <= 0) {
+        std::cerr << "bench_log: -n and -t must be positive" << std::endl;
+        return 1;
+    }
+
+    const std::vector<std::pair<std::string, std::string> > all_patterns = {
+        {"simple",  "%m%n"},
+        {"default", ""},
+        {"full",    "%d{%Y-%m-%d %H:%M:%S}.%ms%T%t%T[%p]%T<%f:%l>%T%r%T%m%n"}
+    };
+    std::vector<std::pair<std::string, std::string> > use_patterns;
+    for (auto& name : Split(patterns)) {
+        auto it = std::find_if(all_patterns.begin(), all_patterns.end(),
+                [&name](const std::pair<std::string, std::string>& p) { return p.first == name; });
+        if (it == all_patterns.end()) {
+            std::cerr << "bench_log: unknown pattern " << name << std::endl;
+            return 1;
+        }
+        use_patterns.push_back(*it);
+    }
+    std::vector<std::string> use_appenders;
+    for (auto& name : Split(appenders)) {
+        if (name != "null" && name != "stdout" && name != "file") {
+            std::cerr << "bench_log: unknown appender " << name << std::endl;
+            return 1;
+        }
+        if (name == "stdout" && !appenders_given && isatty(STDOUT_FILENO)) {
+            std::cerr << "bench_log: stdout is a terminal, skipping the stdout appender" << std::endl;
+            continue;
+        }
+        use_appenders.push_back(name);
+    }
+    std::vector<int> thread_counts;
+    for (int t = 1; t < max_threads; t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(max_threads);
+
+    std::vector<Case> cases;
+    for (int threads : thread_counts) {
+        // a disabled statement costs the same whatever the appender and pattern
+        cases.push_back(Case{"null", "-", "%m%n", false, threads});
+        for (auto& appender : use_appenders) {
+            for (auto& pattern : use_patterns) {
+                cases.push_back(Case{appender, pattern.first, pattern.second, true, threads});
+            }
+        }
+    }
+
+    std::ofstream ofs(output);
+    if (!ofs) {
+        std::cerr << "bench_log: cannot open " << output << std::endl;
+        return 1;
+    }
+    for (auto& c : cases) {
+        Result r = Run(c, lines, filename);
+        double lines_per_sec = r.lines / r.seconds;
+        double mb_per_sec = r.bytes / r.seconds / (1 << 20);
+        ofs << "{\"threads\":" << c.threads
+            << ",\"appender\":\"" << c.appender << "\""
+            << ",\"pattern\":\"" << c.pattern_name << "\""
+            << ",\"level\":\"" << (c.enabled ? "enabled" : "disabled") << "\""
+            << ",\"lines\":" << r.lines
+            << ",\"seconds\":" << r.seconds
+            << ",\"lines_per_sec\":" << (uint64_t)lines_per_sec
+            << ",\"mb_per_sec\":" << mb_per_sec
+            << ",\"p50_ns\":" << r.p50
+            << ",\"p99_ns\":" << r.p99
+            << ",\"p999_ns\":" << r.p999
+            << ",\"max_ns\":" << r.max
+            << "}" << std::endl;
+        std::cerr << "threads=" << c.threads
+                  << "\tappender=" << c.appender
+                  << "\tpattern=" << c.pattern_name
+                  << "\t" << (c.enabled ? "enabled" : "disabled")
+                  << "\tlines/s=" << (uint64_t)lines_per_sec
+                  << "\tMB/s=" << mb_per_sec
+                  << "\tp50=" << r.p50 << "ns"
+                  << "\tp99=" << r.p99 << "ns"
+                  << "\tp999=" << r.p999 << "ns"
+                  << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include "binlog.hpp"
+
+#include <algorithm>
+
+namespace sylar {
+
+/*
+ * --------------- BinLogSink ---------------
+ */
+const uint32_t BinLogSink::s_version;
+
+BinLogSink::BinLogSink (const std::string& filename,
+                        const std::string& name,
+                        const LogFile::Options& options)
+: m_filename(filename),
+  m_name(name) {
+    // sinks on one path share its LogFile, records are appended whole
+    m_file = LogFile::Open(m_filename, options);
+    if (!m_file->isOpen()) {
+        std::cout << "BinLogSink open failed: " << m_filename << std::endl;
+        return;
+    }
+    m_registry = SltBinLogRegistry::GetInstance();
+    m_registry->addSink(this);
+}
+
+BinLogSink::~BinLogSink () {
+    if (m_registry) {
+        m_registry->delSink(this);
+    }
+}
+
+void BinLogSink::writeHeader () {
+    std::string buf(2 * sizeof(uint32_t), '\0');
+    buf.append("SYLB", 4);
+    buf.append((const char*)&s_version, sizeof(s_version));
+    buf.append(m_name.c_str(), m_name.size() + 1);
+    uint32_t head[2] = { (uint32_t)buf.size(), RECORD_HEADER };
+    memcpy(&buf[0], head, sizeof(head));
+    write(buf.data(), buf.size());
+}
+
+void BinLogSink::writeSite (const BinLogSite& site) {
+    std::string buf(2 * sizeof(uint32_t), '\0');
+    uint32_t level = site.level;
+    buf.append((const char*)&site.id, sizeof(site.id));
+    buf.append((const char*)&level, sizeof(level));
+    buf.append((const char*)&site.line, sizeof(site.line));
+    buf.append(site.file, strlen(site.file) + 1);
+    buf.append(site.fmt, strlen(site.fmt) + 1);
+    uint32_t head[2] = { (uint32_t)buf.size(), RECORD_SITE };
+    memcpy(&buf[0], head, sizeof(head));
+    write(buf.data(), buf.size());
+}
+
+std::string& BinLogSink::Buffer () {
+    static thread_local std::string s_buf;
+    return s_buf;
+}
+
+/*
+ * --------------- BinLogRegistry ---------------
+ *  Registering a site and adding a sink hold the same lock, so a sink
+ *  gets every definition before the first record of that site.
+ */
+uint32_t BinLogRegistry::registerSite (LogLevel::Level level, const char* file,
+                                       int32_t line, const char* fmt) {
+    MutexType::Lock lock(m_mutex);
+    BinLogSite site;
+    site.id = m_sites.size();
+    site.level = level;
+    site.file = file;
+    site.line = line;
+    site.fmt = fmt;
+    m_sites.push_back(site);
+    for (auto sink : m_sinks) {
+        sink->writeSite(site);
+    }
+    return site.id;
+}
+
+void BinLogRegistry::addSink (BinLogSink* sink) {
+    MutexType::Lock lock(m_mutex);
+    sink->writeHeader();
+    for (auto& site : m_sites) {
+        sink->writeSite(site);
+    }
+    m_sinks.push_back(sink);
+}
+
+void BinLogRegistry::delSink (BinLogSink* sink) {
+    MutexType::Lock lock(m_mutex);
+    m_sinks.erase(std::remove(m_sinks.begin(), m_sinks.end(), sink), m_sinks.end());
+}
+
+}
@@ -0,0 +1,219 @@
+#ifndef __BINLOG_H__
+#define __BINLOG_H__
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <vector>
+#include <type_traits>
+
+#include "log.hpp"
+
+/*
+ * Binary logging: the call site is registered once (format string, file,
+ * line, level) and every call only writes a compact record with the site
+ * id, time, thread id and the raw arguments to the logger's BinLogSink.
+ * Nothing is formatted at runtime; sylar_logdecode turns the file into
+ * text with a LogFormatter pattern.
+ * The level has to be a constant. Without a sink the message is formatted
+ * and logged like SYLAR_LOG_FMT_LEVEL.
+ */
+#define SYLAR_LOG_BIN_LEVEL(logger, level, fmt, ...)\
+    if (sylar::LogSite* sylar_log_site = SYLAR_LOG_ENABLED(logger, level))\
+        sylar::BinLog(logger, sylar_log_site, []() {\
+                static const uint32_t site = sylar::SltBinLogRegistry::GetInstance()\
+                                             ->registerSite(level, __FILE__, __LINE__, fmt);\
+                return site;\
+            }(), level, __FILE__, __LINE__, fmt, ##__VA_ARGS__)
+
+#define SYLAR_LOG_BIN_DEBUG(logger, fmt, ...) SYLAR_LOG_BIN_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_BIN_INFO(logger, fmt, ...)  SYLAR_LOG_BIN_LEVEL(logger, sylar::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_BIN_WARN(logger, fmt, ...)  SYLAR_LOG_BIN_LEVEL(logger, sylar::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_BIN_ERROR(logger, fmt, ...) SYLAR_LOG_BIN_LEVEL(logger, sylar::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+
+namespace sylar {
+
+class BinLogRegistry;
+
+struct BinLogSite {
+    uint32_t id;
+    LogLevel::Level level;
+    const char* file;
+    int32_t line;
+    const char* fmt;
+};
+
+/*
+ * Record layout (host byte order):
+ *   uint32 size (whole record), uint32 site id or RECORD_*, then
+ *   RECORD_HEADER: "SYLB", uint32 version, logger name \0
+ *   RECORD_SITE:   uint32 id, uint32 level, int32 line, file \0, fmt \0
+ *   event:         uint64 time (us), uint32 thread id, uint32 fiber id,
+ *                  arguments, each a type byte and its value
+ *                  (int64, uint64, double, uint32 length + bytes, uint64)
+ * A RECORD_HEADER starts the ids of a new process or sink; every id is
+ * defined by a RECORD_SITE before its first event.
+ * Sinks on one path share its LogFile (see LogFile::Open), their events
+ * decode under the name of the latest header. The path must not be used
+ * by a text appender as well, its lines would land between the records.
+ */
+class BinLogSink {
+public:
+    typedef std::shared_ptr<BinLogSink> ptr;
+    enum RecordType : uint32_t {
+        RECORD_HEADER = 0xffffffff,
+        RECORD_SITE   = 0xfffffffe
+    };
+    enum ArgType : char {
+        ARG_INT     = 'i',
+        ARG_UINT    = 'u',
+        ARG_DOUBLE  = 'd',
+        ARG_STRING  = 's',
+        ARG_POINTER = 'p'
+    };
+    struct EventHeader {
+        uint32_t size;
+        uint32_t site;
+        uint64_t time;
+        uint32_t thread_id;
+        uint32_t fiber_id;
+    };
+    static const uint32_t s_version = 1;
+
+    BinLogSink (const std::string& filename,
+                const std::string& name,
+                const LogFile::Options& options = LogFile::Options());
+    ~BinLogSink ();
+
+    bool isOpen () const { return m_file->isOpen(); }
+    const std::string& getFilename () const { return m_filename; }
+    void write (const char* data, size_t len) { m_file->append(data, len); }
+    // a new process or sink restates the site ids
+    void writeHeader ();
+    void writeSite (const BinLogSite& site);
+    void flush () { m_file->flush(); }
+
+    // per-thread buffer the records are built in
+    static std::string& Buffer ();
+private:
+    std::string m_filename;
+    std::string m_name;
+    LogFile::ptr m_file;
+    // keeps the registry alive until the last sink is gone
+    std::shared_ptr<BinLogRegistry> m_registry;
+};
+
+// every call site, written to each sink before its first record
+class BinLogRegistry {
+public:
+    typedef Mutex MutexType;
+    uint32_t registerSite (LogLevel::Level level, const char* file, int32_t line, const char* fmt);
+    void addSink (BinLogSink* sink);
+    void delSink (BinLogSink* sink);
+private:
+    MutexType m_mutex;
+    std::vector<BinLogSite> m_sites;
+    std::vector<BinLogSink*> m_sinks;
+};
+
+typedef SingletonPtr<BinLogRegistry> SltBinLogRegistry;
+
+/*
+ * Argument encoding
+ */
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+BinLogPut (std::string& buf, T value) {
+    int64_t v = value;
+    buf.push_back(BinLogSink::ARG_INT);
+    buf.append((const char*)&v, sizeof(v));
+}
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+BinLogPut (std::string& buf, T value) {
+    uint64_t v = value;
+    buf.push_back(BinLogSink::ARG_UINT);
+    buf.append((const char*)&v, sizeof(v));
+}
+
+template<class T>
+typename std::enable_if<std::is_enum<T>::value>::type
+BinLogPut (std::string& buf, T value) {
+    BinLogPut(buf, (int64_t)value);
+}
+
+template<class T>
+typename std::enable_if<std::is_floating_point<T>::value>::type
+BinLogPut (std::string& buf, T value) {
+    double v = value;
+    buf.push_back(BinLogSink::ARG_DOUBLE);
+    buf.append((const char*)&v, sizeof(v));
+}
+
+inline void BinLogPutString (std::string& buf, const char* str, uint32_t len) {
+    buf.push_back(BinLogSink::ARG_STRING);
+    buf.append((const char*)&len, sizeof(len));
+    buf.append(str, len);
+}
+
+inline void BinLogPut (std::string& buf, const char* str) {
+    if (!str) {
+        str = "(null)";
+    }
+    BinLogPutString(buf, str, strlen(str));
+}
+
+inline void BinLogPut (std::string& buf, char* str) {
+    BinLogPut(buf, (const char*)str);
+}
+
+inline void BinLogPut (std::string& buf, const std::string& str) {
+    BinLogPutString(buf, str.data(), str.size());
+}
+
+template<class T>
+void BinLogPut (std::string& buf, T* ptr) {
+    uint64_t v = (uintptr_t)ptr;
+    buf.push_back(BinLogSink::ARG_POINTER);
+    buf.append((const char*)&v, sizeof(v));
+}
+
+inline void BinLogPutArgs (std::string& buf) {}
+
+template<class T, class... Args>
+void BinLogPutArgs (std::string& buf, const T& value, const Args&... args) {
+    BinLogPut(buf, value);
+    BinLogPutArgs(buf, args...);
+}
+
+// printf arguments for the fallback without a sink
+template<class T>
+const T& BinLogVarArg (const T& value) { return value; }
+inline const char* BinLogVarArg (const std::string& str) { return str.c_str(); }
+
+template<class... Args>
+void BinLog (const std::shared_ptr<Logger>& logger, const LogSite* log_site, uint32_t site, 
+             LogLevel::Level level, const char* file, int32_t line, const char* fmt, const Args&... args) {
+    BinLogSink::ptr sink = logger->getBinarySink();
+    // below the logger's level the event is only for the FlightRecorder
+    if (!sink || (level < logger->getLevel() && !(log_site && log_site->isForced(logger->getName())))) {
+        LogEventWrap(LogEvent::Acquire(logger, level, file, line, GetThreadID(), GetFiberID(), 0, log_site))
+            .getEvent()->format(fmt, BinLogVarArg(args)...);
+        return;
+    }
+    std::string& buf = BinLogSink::Buffer();
+    buf.resize(sizeof(BinLogSink::EventHeader));
+    BinLogPutArgs(buf, args...);
+    BinLogSink::EventHeader* header = (BinLogSink::EventHeader*)&buf[0];
+    header->size = buf.size();
+    header->site = site;
+    header->time = GetCurrentUS();
+    header->thread_id = GetThreadID();
+    header->fiber_id = GetFiberID();
+    sink->write(buf.data(), buf.size());
+}
+
+}
+
+#endif
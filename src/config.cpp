@@ -10,29 +10,96 @@ ConfigVarBase::ptr Config::LookupBase(const std::string& name){
     return it == GetData().end() ? nullptr : it->second;
 }
 
+bool ConfigVarBase::fromNode (const YAML::Node& node) {
+    if (node.IsScalar()) {
+        return fromString(node.Scalar());
+    }
+    std::stringstream ss;
+    ss << node;
+    return fromString(ss.str());
+}
+
 /*
  * --------------- Config ---------------
  */
-static void ListAllMember (const std::string& prefix,
-                           const YAML::Node& node,
-                           std::list<std::pair<std::string, const YAML::Node> >& output) {
+static uint64_t HashCombine (uint64_t h, uint64_t v) {
+    return h ^ (v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2));
+}
+
+// sizes and strings are length-prefixed, so equal text means equal content
+static void AppendSize (std::string& text, size_t size) {
+    text.append((const char*)&size, sizeof(size));
+}
+
+static void AppendString (std::string& text, const std::string& str) {
+    AppendSize(text, str.size());
+    text.append(str);
+}
+
+// hash of a whole subtree, equal subtrees give equal hashes.
+// The subtree is also appended to text, to tell a collision from a match
+static uint64_t HashNode (const YAML::Node& node, std::string& text) {
+    uint64_t h = node.Type();
+    text.push_back((char)node.Type());
+    if (node.IsScalar()) {
+        AppendString(text, node.Scalar());
+        return HashCombine(h, std::hash<std::string>()(node.Scalar()));
+    }
+    AppendSize(text, node.size());
+    for (auto it = node.begin(); it != node.end(); ++it) {
+        if (node.IsMap()) {
+            AppendString(text, it->first.Scalar());
+            h = HashCombine(h, std::hash<std::string>()(it->first.Scalar()));
+            h = HashCombine(h, HashNode(it->second, text));
+        }
+        else {
+            h = HashCombine(h, HashNode(*it, text));
+        }
+    }
+    return h;
+}
+
+struct ConfigMember {
+    std::string name;
+    YAML::Node node;
+    uint64_t hash;
+    // the subtree in the load's text
+    size_t begin;
+    size_t end;
+};
+
+// return the hash of node, hashing every node once
+static uint64_t ListAllMember (const std::string& prefix,
+                               const YAML::Node& node,
+                               std::list<ConfigMember>& output,
+                               std::string& text) {
     // Check
     if (prefix.find_first_not_of ("abcdefghijklmnopqrstuvwxyzABCDEFGHIMNOPQRSTUVWXYZ._0123456789")!=std::string::npos) {
         SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config invalid name: " << prefix << " : " << node;
-        return;
+        return HashNode(node, text);
     }
-    // push pair of string and node
-    output.push_back(std::make_pair(prefix, node));
-
-    if (node.IsMap()) {
-        for (auto it = node.begin(); it != node.end(); ++it) {
-            // recursive
-            ListAllMember(prefix.empty() 
-                          ? it->first.Scalar() // no prefix
-                          : prefix + "." + it->first.Scalar(), // add prefix 
-                          it->second, 
-                          output);
-        }
+    // push the member, its hash is known once the children are listed
+    output.push_back(ConfigMember{prefix, node, 0, text.size(), 0});
+    ConfigMember& member = output.back();
+
+    if (!node.IsMap()) {
+        member.hash = HashNode(node, text);
+        member.end = text.size();
+        return member.hash;
+    }
+    uint64_t h = node.Type();
+    text.push_back((char)node.Type());
+    AppendSize(text, node.size());
+    for (auto it = node.begin(); it != node.end(); ++it) {
+        // recursive
+        AppendString(text, it->first.Scalar());
+        h = HashCombine(h, std::hash<std::string>()(it->first.Scalar()));
+        h = HashCombine(h, ListAllMember(prefix.empty() 
+                                         ? it->first.Scalar() // no prefix
+                                         : prefix + "." + it->first.Scalar(), // add prefix 
+                                         it->second, 
+                                         output,
+                                         text));
     }
     /*
     else if (node.IsSequence()) { 
@@ -44,34 +111,73 @@ static void ListAllMember (const std::string& prefix,
         }
     }
     */
+    member.hash = h;
+    member.end = text.size();
+    return h;
 }
 
-void Config::LoadFromYaml(const YAML::Node& root) {
-    // <name, node> pair
-    std::list<std::pair<std::string, const YAML::Node> > all_nodes;
+// what the previous load found under each name
+struct LoadedMember {
+    uint64_t hash;
+    // the subtree in s_loaded_text, compared when the hashes match
+    size_t begin;
+    size_t end;
+    // a ConfigVar took the value
+    bool applied;
+};
+
+static Mutex s_load_mutex;
+static std::unordered_map<std::string, LoadedMember> s_loaded;
+static std::string s_loaded_text;
+// vars which existed at the previous load
+static size_t s_loaded_vars = 0;
+
+void Config::LoadFromYaml(const YAML::Node& root, bool incremental) {
+    // loads are serialized, each one diffs against the one before
+    Mutex::Lock load_lock(s_load_mutex);
+    std::list<ConfigMember> all_nodes;
+    std::string text;
     // read nodes from yaml file
-    ListAllMember ("", root, all_nodes);
+    ListAllMember ("", root, all_nodes, text);
+    size_t vars = 0;
+    {
+        MutexType::ReadLock lock(GetMutex());
+        vars = GetData().size();
+    }
+    // vars are never removed, a name which had none may have one now
+    bool new_vars = vars != s_loaded_vars;
 
+    std::unordered_map<std::string, LoadedMember> loaded;
     for (auto& i : all_nodes) {
-        std::string key = i.first;
+        std::string key = i.name;
         if (key.empty()) {
             continue;
         }
         // transform to lowercase
         std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+        if (incremental) {
+            auto it = s_loaded.find(key);
+            size_t len = i.end - i.begin;
+            if (it != s_loaded.end() && it->second.hash == i.hash
+                    && it->second.end - it->second.begin == len
+                    && s_loaded_text.compare(it->second.begin, len, text, i.begin, len) == 0
+                    && (it->second.applied || !new_vars)) {
+                // same content as the previous load
+                loaded[key] = LoadedMember{i.hash, i.begin, i.end, it->second.applied};
+                continue;
+            }
+        }
         // find 
         ConfigVarBase::ptr var = LookupBase(key);
+        bool applied = false;
         if (var) { // exist
-            if (i.second.IsScalar()) {
-                var->fromString(i.second.Scalar());
-            }
-            else{ // if (i.second.IsMap()){
-                std::stringstream ss;
-                ss << i.second;
-                var->fromString(ss.str());
-            }
+            applied = var->fromNode(i.node);
         }
+        loaded[key] = LoadedMember{i.hash, i.begin, i.end, applied};
     }
+    s_loaded.swap(loaded);
+    s_loaded_text.swap(text);
+    s_loaded_vars = vars;
 }
 
 
@@ -14,6 +14,9 @@
 #include <boost/lexical_cast.hpp>
 #include <yaml-cpp/yaml.h>
 #include <functional>
+#include <atomic>
+#include <sstream>
+#include <type_traits>
 
 #include "log.hpp"
 #include "threads.hpp"
@@ -37,6 +40,8 @@ public:
 
     virtual std::string toString() = 0;
     virtual bool fromString (const std::string& val) = 0;
+    // set from an already parsed node, through fromString by default
+    virtual bool fromNode (const YAML::Node& node);
     virtual std::string getTypeName () const = 0;
 protected:
     std::string m_name;
@@ -52,6 +57,233 @@ public:
     }
 };
 
+/*
+ * Node level conversion: FromNode<T> builds a T from a parsed YAML::Node,
+ * ToNode<T> builds the node of a T. The containers walk the node tree once
+ * and convert their elements in place, instead of printing every element
+ * and parsing it again. A type without its own FromNode / ToNode goes
+ * through its LexicalCast string form, so specializing LexicalCast is
+ * still enough; specializing FromNode / ToNode is faster.
+ */
+template<class T>
+class FromNode {
+public:
+    T operator() (const YAML::Node& node) {
+        if (node.IsScalar()) {
+            return LexicalCast<std::string, T>() (node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return LexicalCast<std::string, T>() (ss.str());
+    }
+};
+
+template<class T>
+class ToNode {
+public:
+    YAML::Node operator() (const T& v) {
+        return convert(v, std::integral_constant<bool, std::is_arithmetic<T>::value
+                                                       || std::is_same<T, std::string>::value>());
+    }
+private:
+    // numbers and strings are scalars, no need to parse them
+    YAML::Node convert (const T& v, std::true_type) {
+        return YAML::Node(LexicalCast<T, std::string>() (v));
+    }
+    YAML::Node convert (const T& v, std::false_type) {
+        return YAML::Load(LexicalCast<T, std::string>() (v));
+    }
+};
+
+template<>
+class FromNode<std::string> {
+public:
+    std::string operator() (const YAML::Node& node) {
+        if (node.IsScalar()) {
+            return node.Scalar();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+};
+
+template<>
+class ToNode<std::string> {
+public:
+    YAML::Node operator() (const std::string& v) {
+        return YAML::Node(v);
+    }
+};
+
+// yaml sequence to vector
+template<class T>
+class FromNode<std::vector<T> > {
+public:
+    std::vector<T> operator() (const YAML::Node& node) {
+        std::vector<T> vec;
+        if (node.IsSequence()) {
+            for (auto it = node.begin(); it != node.end(); ++it) {
+                vec.push_back(FromNode<T>() (*it));
+            }
+        }
+        return vec;
+    }
+};
+
+// vector to yaml sequence
+template<class F>
+class ToNode<std::vector<F> > {
+public:
+    YAML::Node operator() (const std::vector<F>& vec) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : vec) {
+            node.push_back(ToNode<F>() (i));
+        }
+        return node;
+    }
+};
+
+// yaml sequence to list
+template<class T>
+class FromNode<std::list<T> > {
+public:
+    std::list<T> operator() (const YAML::Node& node) {
+        std::list<T> vec;
+        if (node.IsSequence()) {
+            for (auto it = node.begin(); it != node.end(); ++it) {
+                vec.push_back(FromNode<T>() (*it));
+            }
+        }
+        return vec;
+    }
+};
+
+// list to yaml sequence
+template<class F>
+class ToNode<std::list<F> > {
+public:
+    YAML::Node operator() (const std::list<F>& vec) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : vec) {
+            node.push_back(ToNode<F>() (i));
+        }
+        return node;
+    }
+};
+
+// yaml sequence to set
+template<class T>
+class FromNode<std::set<T> > {
+public:
+    std::set<T> operator() (const YAML::Node& node) {
+        std::set<T> vec;
+        if (node.IsSequence()) {
+            for (auto it = node.begin(); it != node.end(); ++it) {
+                vec.insert(FromNode<T>() (*it));
+            }
+        }
+        return vec;
+    }
+};
+
+// set to yaml sequence
+template<class F>
+class ToNode<std::set<F> > {
+public:
+    YAML::Node operator() (const std::set<F>& vec) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : vec) {
+            node.push_back(ToNode<F>() (i));
+        }
+        return node;
+    }
+};
+
+// yaml sequence to unordered_set
+template<class T>
+class FromNode<std::unordered_set<T> > {
+public:
+    std::unordered_set<T> operator() (const YAML::Node& node) {
+        std::unordered_set<T> vec;
+        if (node.IsSequence()) {
+            for (auto it = node.begin(); it != node.end(); ++it) {
+                vec.insert(FromNode<T>() (*it));
+            }
+        }
+        return vec;
+    }
+};
+
+// unordered_set to yaml sequence
+template<class F>
+class ToNode<std::unordered_set<F> > {
+public:
+    YAML::Node operator() (const std::unordered_set<F>& vec) {
+        YAML::Node node(YAML::NodeType::Sequence);
+        for (auto& i : vec) {
+            node.push_back(ToNode<F>() (i));
+        }
+        return node;
+    }
+};
+
+// yaml map to map
+template<class T>
+class FromNode<std::map<std::string, T> > {
+public:
+    std::map<std::string, T> operator() (const YAML::Node& node) {
+        std::map<std::string, T> map;
+        if (node.IsMap()) {
+            for (auto it = node.begin(); it != node.end(); ++it) {
+                map.insert(std::make_pair(it->first.Scalar(), FromNode<T>() (it->second)));
+            }
+        }
+        return map;
+    }
+};
+
+// map to yaml map
+template<class F>
+class ToNode<std::map<std::string, F> > {
+public:
+    YAML::Node operator() (const std::map<std::string, F>& map) {
+        YAML::Node node(YAML::NodeType::Map);
+        for (auto& i : map) {
+            node[i.first] = ToNode<F>() (i.second);
+        }
+        return node;
+    }
+};
+
+// yaml map to unordered_map
+template<class T>
+class FromNode<std::unordered_map<std::string, T> > {
+public:
+    std::unordered_map<std::string, T> operator() (const YAML::Node& node) {
+        std::unordered_map<std::string, T> map;
+        if (node.IsMap()) {
+            for (auto it = node.begin(); it != node.end(); ++it) {
+                map.insert(std::make_pair(it->first.Scalar(), FromNode<T>() (it->second)));
+            }
+        }
+        return map;
+    }
+};
+
+// unordered_map to yaml map
+template<class F>
+class ToNode<std::unordered_map<std::string, F> > {
+public:
+    YAML::Node operator() (const std::unordered_map<std::string, F>& map) {
+        YAML::Node node(YAML::NodeType::Map);
+        for (auto& i : map) {
+            node[i.first] = ToNode<F>() (i.second);
+        }
+        return node;
+    }
+};
+
 /*
  * Partial Template Specialization
  */
@@ -61,15 +293,7 @@ template<class T>
 class LexicalCast<std::string, std::vector<T> > {
 public:
     std::vector<T> operator() (const std::string& string) {
-        YAML::Node node = YAML::Load(string);
-        typename std::vector<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str(""); // flesh stringstream 
-            ss << node[i];
-            vec.push_back(LexicalCast<std::string, T>() (ss.str()));
-        }
-        return vec;
+        return FromNode<std::vector<T> >() (YAML::Load(string));
     }
 };
 
@@ -77,13 +301,9 @@ public:
 template<class F>
 class LexicalCast<std::vector<F>, std::string> {
 public:
-    std::string operator() (const std::vector<F>& vec) {
-        YAML::Node node;
-        for (auto& i : vec) {
-            node.push_back(YAML::Load(LexicalCast<F, std::string>() (i)));
-        }
+    std::string operator() (const std::vector<F>& v) {
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::vector<F> >() (v);
         return ss.str();
     }
 };
@@ -93,15 +313,7 @@ template<class T>
 class LexicalCast<std::string, std::list<T> > {
 public:
     std::list<T> operator() (const std::string& string) {
-        YAML::Node node = YAML::Load(string);
-        typename std::list<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str(""); // flesh stringstream 
-            ss << node[i];
-            vec.push_back(LexicalCast<std::string, T>() (ss.str()));
-        }
-        return vec;
+        return FromNode<std::list<T> >() (YAML::Load(string));
     }
 };
 
@@ -109,13 +321,9 @@ public:
 template<class F>
 class LexicalCast<std::list<F>, std::string> {
 public:
-    std::string operator() (const std::list<F>& vec) {
-        YAML::Node node;
-        for (auto& i : vec) {
-            node.push_back(YAML::Load(LexicalCast<F, std::string>() (i)));
-        }
+    std::string operator() (const std::list<F>& v) {
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::list<F> >() (v);
         return ss.str();
     }
 };
@@ -125,15 +333,7 @@ template<class T>
 class LexicalCast<std::string, std::set<T> > {
 public:
     std::set<T> operator() (const std::string& string) {
-        YAML::Node node = YAML::Load(string);
-        typename std::set<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str(""); // flesh stringstream 
-            ss << node[i];
-            vec.insert(LexicalCast<std::string, T>() (ss.str()));
-        }
-        return vec;
+        return FromNode<std::set<T> >() (YAML::Load(string));
     }
 };
 
@@ -141,13 +341,9 @@ public:
 template<class F>
 class LexicalCast<std::set<F>, std::string> {
 public:
-    std::string operator() (const std::set<F>& vec) {
-        YAML::Node node;
-        for (auto& i : vec) {
-            node.push_back(YAML::Load(LexicalCast<F, std::string>() (i)));
-        }
+    std::string operator() (const std::set<F>& v) {
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::set<F> >() (v);
         return ss.str();
     }
 };
@@ -157,15 +353,7 @@ template<class T>
 class LexicalCast<std::string, std::unordered_set<T> > {
 public:
     std::unordered_set<T> operator() (const std::string& string) {
-        YAML::Node node = YAML::Load(string);
-        typename std::unordered_set<T> vec;
-        std::stringstream ss;
-        for (size_t i = 0; i < node.size(); ++i) {
-            ss.str(""); // flesh stringstream 
-            ss << node[i];
-            vec.insert(LexicalCast<std::string, T>() (ss.str()));
-        }
-        return vec;
+        return FromNode<std::unordered_set<T> >() (YAML::Load(string));
     }
 };
 
@@ -173,13 +361,9 @@ public:
 template<class F>
 class LexicalCast<std::unordered_set<F>, std::string> {
 public:
-    std::string operator() (const std::unordered_set<F>& vec) {
-        YAML::Node node;
-        for (auto& i : vec) {
-            node.push_back(YAML::Load(LexicalCast<F, std::string>() (i)));
-        }
+    std::string operator() (const std::unordered_set<F>& v) {
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::unordered_set<F> >() (v);
         return ss.str();
     }
 };
@@ -189,17 +373,7 @@ template<class T>
 class LexicalCast<std::string, std::map<std::string, T> > {
 public:
     std::map<std::string, T> operator() (const std::string& string) {
-        YAML::Node node = YAML::Load(string);
-        typename std::map<std::string, T> map;
-        std::stringstream ss;
-        
-        for (auto it = node.begin(); it != node.end(); ++it) {
-            ss.str(""); // flesh stringstream 
-            ss << it->second;
-            map.insert(std::make_pair(it->first.Scalar(),
-                        LexicalCast<std::string, T>() (ss.str())));
-        }
-        return map;
+        return FromNode<std::map<std::string, T> >() (YAML::Load(string));
     }
 };
 
@@ -207,13 +381,9 @@ public:
 template<class F>
 class LexicalCast<std::map<std::string, F>, std::string> {
 public:
-    std::string operator() (const std::map<std::string, F>& map) {
-        YAML::Node node;
-        for (auto& i : map) {
-            node[i.first] = YAML::Load(LexicalCast<F, std::string>() (i.second));
-        }
+    std::string operator() (const std::map<std::string, F>& v) {
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::map<std::string, F> >() (v);
         return ss.str();
     }
 };
@@ -223,31 +393,17 @@ template<class T>
 class LexicalCast<std::string, std::unordered_map<std::string, T> > {
 public:
     std::unordered_map<std::string, T> operator() (const std::string& string) {
-        YAML::Node node = YAML::Load(string);
-        typename std::unordered_map<std::string, T> map;
-        std::stringstream ss;
-        
-        for (auto it = node.begin(); it != node.end(); ++it) {
-            ss.str(""); // flesh stringstream 
-            ss << it->second;
-            map.insert(std::make_pair(it->first.Scalar(),
-                        LexicalCast<std::string, T>() (ss.str())));
-        }
-        return map;
+        return FromNode<std::unordered_map<std::string, T> >() (YAML::Load(string));
     }
 };
 
-// map to string
+// unordered_map to string
 template<class F>
 class LexicalCast<std::unordered_map<std::string, F>, std::string> {
 public:
-    std::string operator() (const std::unordered_map<std::string, F>& map) {
-        YAML::Node node;
-        for (auto& i : map) {
-            node[i.first] = YAML::Load(LexicalCast<F, std::string>() (i.second));
-        }
+    std::string operator() (const std::unordered_map<std::string, F>& v) {
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<std::unordered_map<std::string, F> >() (v);
         return ss.str();
     }
 };
@@ -266,21 +422,52 @@ template <class T,
 class ConfigVar : public ConfigVarBase{
 public:
     typedef std::shared_ptr<ConfigVar> ptr;
+    // an immutable value, never changed once published
+    typedef std::shared_ptr<const T> ConstPtr;
     typedef std::function<void (const T& old_value, const T& new_value)> on_change_callback;
+
+    /*
+     * Keeps the last snapshot of a ConfigVar and rereads it only after
+     * setValue published a new one, so get() is two loads and a compare.
+     * This is the wait-free read: getSnapshot() and getValue() go through
+     * std::atomic_load, which libstdc++ implements with a mutex.
+     * One per thread, e.g.
+     *   static thread_local ConfigVar<T>::LocalCache s_cache(g_var);
+     *   const T& v = s_cache.get();
+     * The reference stays valid until the next get() of the same cache.
+     */
+    class LocalCache {
+    public:
+        LocalCache (const ptr& var) : m_var(var), m_version(0) {}
+        const T& get () {
+            uint64_t version = m_var->getVersion();
+            if (version != m_version) {
+                // may be newer than version, then the next get() reloads it
+                m_val = m_var->getSnapshot();
+                m_version = version;
+            }
+            return *m_val;
+        }
+    private:
+        ptr m_var;
+        uint64_t m_version;
+        ConstPtr m_val;
+    };
+
     ConfigVar(const std::string& name, 
               const T& default_value, 
               const std::string& description)
     : ConfigVarBase(name, description),
-      m_val(default_value) {
+      m_val(std::make_shared<const T>(default_value)),
+      m_version(1) {
 
       }
     std::string toString() override {
         try {
             //return boost::lexical_cast<std::string> (m_val); // Directly convert to string
-            MutexType::ReadLock lock(m_lock);
-            return ToStr() (m_val);
+            return ToStr() (*getSnapshot());
         } catch (std::exception& e) {
-            SYLAR_LOG_LEVEL(SYLAR_LOG_ROOT(), LogLevel::ALL) << "ConfigVar::toString exception" << e.what() << " convert " << typeid(m_val).name() << " to string.";
+            SYLAR_LOG_LEVEL(SYLAR_LOG_ROOT(), LogLevel::ALL) << "ConfigVar::toString exception" << e.what() << " convert " << typeid(T).name() << " to string.";
         }
         return "";
     }
@@ -291,27 +478,43 @@ public:
             setValue(FromStr() (val)); 
             return true;
         } catch (std::exception& e) {
-            SYLAR_LOG_LEVEL(SYLAR_LOG_ROOT(), LogLevel::ALL) << "ConfigVar::fromString exception" << e.what() << " convert string to " << typeid(m_val).name() << ".";
+            SYLAR_LOG_LEVEL(SYLAR_LOG_ROOT(), LogLevel::ALL) << "ConfigVar::fromString exception" << e.what() << " convert string to " << typeid(T).name() << ".";
         }
         return false;
     }
-    const T getValue () {
-        MutexType::ReadLock lock(m_lock);
-        return m_val; 
+    bool fromNode (const YAML::Node& node) override {
+        try {
+            // a custom FromStr only knows the string form
+            setValue(convertNode(node, std::is_same<FromStr, LexicalCast<std::string, T> >()));
+            return true;
+        } catch (std::exception& e) {
+            SYLAR_LOG_LEVEL(SYLAR_LOG_ROOT(), LogLevel::ALL) << "ConfigVar::fromNode exception" << e.what() << " convert node to " << typeid(T).name() << ".";
+        }
+        return false;
     }
+    // current value without copying, it stays alive and unchanged as long
+    // as the handle is kept. Not lock-free: std::atomic_load on a shared_ptr
+    // takes one of libstdc++'s pool mutexes for the refcount increment, 
+    // it never waits for setValue's lock or its listeners though
+    ConstPtr getSnapshot () const { return std::atomic_load(&m_val); }
+    // bumped by every setValue which changes the value, after publishing it
+    uint64_t getVersion () const { return m_version.load(std::memory_order_acquire); }
+    // a copy of the current value, use getSnapshot() for large types and 
+    // a LocalCache on hot paths
+    const T getValue () { return *getSnapshot(); }
     void setValue (const T& val) {
-        { // to release the mutex
-            if (val == m_val) {
-                return;
-            }
-            MutexType::WriteLock lock(m_lock);
-            // call the callback functions
-            for (auto& f : m_callbacks) {
-                f.second(m_val, val);
-            }
+        // writers are serialized, readers never wait for the listeners
+        MutexType::WriteLock lock(m_lock);
+        ConstPtr old_val = getSnapshot();
+        if (val == *old_val) {
+            return;
         }
-        MutexType::ReadLock lock(m_lock);
-        m_val = val; 
+        // call the callback functions
+        for (auto& f : m_callbacks) {
+            f.second(*old_val, val);
+        }
+        std::atomic_store(&m_val, std::make_shared<const T>(val));
+        m_version.fetch_add(1, std::memory_order_release);
     }
     std::string getTypeName () const override { return typeid(T).name(); }
     
@@ -339,9 +542,24 @@ public:
     }
 
 private:
-    T m_val;
+    T convertNode (const YAML::Node& node, std::true_type) {
+        return FromNode<T>() (node);
+    }
+    T convertNode (const YAML::Node& node, std::false_type) {
+        if (node.IsScalar()) {
+            return FromStr() (node.Scalar());
+        }
+        std::stringstream ss;
+        ss << node;
+        return FromStr() (ss.str());
+    }
+private:
+    // replaced as a whole with std::atomic_store, never written in place
+    ConstPtr m_val;
+    std::atomic<uint64_t> m_version;
     // function group <key(int64_t, unique, hash), function>
     std::map<uint64_t, on_change_callback> m_callbacks;
+    // guards m_callbacks and serializes setValue
     MutexType m_lock;
 };
 
@@ -390,7 +608,17 @@ public:
         return std::dynamic_pointer_cast<ConfigVar<T> > (it->second);
     }
 
-    static void LoadFromYaml(const YAML::Node& root);
+    /*
+     * Set every ConfigVar named in root. Each load remembers a hash of the
+     * subtree under each name; an incremental load converts only the names
+     * whose subtree changed since the previous load (or which had no var
+     * then), the others keep their values and listeners are not called.
+     * A value changed by setValue in between is not reset by an
+     * incremental load of the same content. Either way the whole tree is
+     * walked, hashed and serialized, and a subtree with the previous hash
+     * is compared with the previous text; only the conversions are saved.
+     */
+    static void LoadFromYaml(const YAML::Node& root, bool incremental = false);
     static ConfigVarBase::ptr LookupBase(const std::string& name);
     static void Visit(std::function<void(ConfigVarBase::ptr)> callback);
 private:
@@ -0,0 +1,386 @@
+#include "flightrecorder.hpp"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include "config.hpp"
+
+namespace sylar {
+
+/*
+ * --------------- FlightRecorder ---------------
+ *  A slot is written like a seqlock: seq is 0 while the fields change and
+ *  n + 1 once event n is complete. dump() copies a slot and keeps it only
+ *  if seq was n + 1 before and after the copy, so it may run concurrently
+ *  with the writers, or in a signal handler on top of one.
+ */
+struct FlightRecorder::Slot {
+    std::atomic<uint64_t> seq{0};
+    uint64_t time;      // us since the epoch
+    const char* file;
+    int32_t line;
+    uint32_t thread;
+    uint32_t fiber;
+    uint16_t level;
+    uint16_t size;      // bytes of the message kept
+    uint32_t length;    // bytes of the message
+    char message[s_messageSize];
+};
+
+struct FlightRecorder::Ring {
+    Ring (size_t capacity) : mask(capacity - 1), slots(new Slot[capacity]) {}
+    const size_t mask;
+    std::unique_ptr<Slot[]> slots;
+    // events written so far
+    std::atomic<uint64_t> head{0};
+    // false once the thread which wrote it has exited
+    std::atomic<bool> owned{true};
+    Ring* next = nullptr;
+};
+
+// gives the thread's ring back when the thread exits
+struct FlightRecorder::LocalRing {
+    Ring* ring = nullptr;
+    ~LocalRing () {
+        if (ring) {
+            ring->owned.store(false, std::memory_order_release);
+            ring = nullptr;
+        }
+    }
+};
+
+namespace {
+
+// text of one dumped event, built without the allocator or locale
+class DumpLine {
+public:
+    void append (const char* s, size_t n) {
+        n = std::min(n, sizeof(m_buf) - m_size);
+        memcpy(m_buf + m_size, s, n);
+        m_size += n;
+    }
+    void append (const char* s) { append(s, strlen(s)); }
+    void append (char c) { append(&c, 1); }
+    // width: pad with zeros
+    void appendNumber (uint64_t v, int width = 0) {
+        char tmp[20];
+        int n = 0;
+        do {
+            tmp[n++] = '0' + v % 10;
+            v /= 10;
+        } while (v);
+        while (n < width && n < (int)sizeof(tmp)) {
+            tmp[n++] = '0';
+        }
+        while (n) {
+            append(tmp[--n]);
+        }
+    }
+    // "2024-01-31 23:59:59.123456" (localtime_r is not async-signal-safe)
+    void appendTime (int64_t us, long utc_offset) {
+        int64_t sec = us / 1000000 + utc_offset;
+        int64_t days = sec / 86400;
+        int64_t rest = sec % 86400;
+        // civil date of a day count since 1970-01-01
+        int64_t z = days + 719468;
+        int64_t era = z / 146097;
+        int64_t doe = z - era * 146097;
+        int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+        int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+        int64_t mp = (5 * doy + 2) / 153;
+        int64_t day = doy - (153 * mp + 2) / 5 + 1;
+        int64_t month = mp < 10 ? mp + 3 : mp - 9;
+        int64_t year = yoe + era * 400 + (month <= 2);
+        appendNumber((uint64_t)year, 4);
+        append('-');
+        appendNumber((uint64_t)month, 2);
+        append('-');
+        appendNumber((uint64_t)day, 2);
+        append(' ');
+        appendNumber((uint64_t)rest / 3600, 2);
+        append(':');
+        appendNumber((uint64_t)rest / 60 % 60, 2);
+        append(':');
+        appendNumber((uint64_t)rest % 60, 2);
+        append('.');
+        appendNumber((uint64_t)(us % 1000000), 6);
+    }
+    const char* data () const { return m_buf; }
+    size_t size () const { return m_size; }
+private:
+    char m_buf[FlightRecorder::s_messageSize + 256];
+    size_t m_size = 0;
+};
+
+static bool WriteAll (int fd, const char* data, size_t size) {
+    while (size) {
+        ssize_t n = ::write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+static const int s_crashSignals[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+
+}
+
+const size_t FlightRecorder::s_messageSize;
+
+FlightRecorder::FlightRecorder ()
+: m_level(LogLevel::OFF),
+  m_capacity(256),
+  m_rings(nullptr),
+  m_utcOffset(0) {
+    m_crashFile[0] = '\0';
+}
+
+void FlightRecorder::setLevel (LogLevel::Level level) {
+    time_t now = time(0);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    m_utcOffset.store(tm.tm_gmtoff, std::memory_order_relaxed);
+    m_level.store(level, std::memory_order_relaxed);
+    SltLoggerMgr::GetInstance()->updateLevels();
+}
+
+void FlightRecorder::setCapacity (size_t events) {
+    size_t capacity = 1;
+    while (capacity < events) {
+        capacity <<= 1;
+    }
+    m_capacity.store(capacity, std::memory_order_relaxed);
+}
+
+FlightRecorder::Ring* FlightRecorder::localRing () {
+    static thread_local LocalRing t_ring;
+    if (SYLAR_LIKELY(t_ring.ring != nullptr)) {
+        return t_ring.ring;
+    }
+    size_t capacity = getCapacity();
+    // take over the ring of a thread which has exited
+    for (Ring* ring = m_rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        bool owned = false;
+        if (ring->mask + 1 == capacity &&
+                ring->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+            t_ring.ring = ring;
+            return ring;
+        }
+    }
+    Ring* ring = new Ring(capacity);
+    ring->next = m_rings.load(std::memory_order_relaxed);
+    while (!m_rings.compare_exchange_weak(ring->next, ring, std::memory_order_release)) {
+    }
+    t_ring.ring = ring;
+    return ring;
+}
+
+void FlightRecorder::record (const LogEvent& event) {
+    Ring* ring = localRing();
+    uint64_t n = ring->head.load(std::memory_order_relaxed);
+    Slot& slot = ring->slots[n & ring->mask];
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.time = (uint64_t)event.getTime() * 1000000 + event.getUsec();
+    slot.file = event.getFileName();
+    slot.line = event.getLineNumber();
+    slot.thread = event.getThreadID();
+    slot.fiber = event.getFiberID();
+    slot.level = event.getLevel();
+    slot.length = event.getContentSize();
+    slot.size = std::min(event.getContentSize(), s_messageSize);
+    memcpy(slot.message, event.getContentData(), slot.size);
+    slot.seq.store(n + 1, std::memory_order_release);
+    ring->head.store(n + 1, std::memory_order_release);
+}
+
+bool FlightRecorder::dump (int fd) const {
+    long utc_offset = m_utcOffset.load(std::memory_order_relaxed);
+    for (Ring* ring = m_rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t begin = head > ring->mask + 1 ? head - ring->mask - 1 : 0;
+        for (uint64_t n = begin; n < head; ++n) {
+            const Slot& slot = ring->slots[n & ring->mask];
+            if (slot.seq.load(std::memory_order_acquire) != n + 1) {
+                // being written, or already overwritten
+                continue;
+            }
+            Slot copy;
+            copy.time = slot.time;
+            copy.file = slot.file;
+            copy.line = slot.line;
+            copy.thread = slot.thread;
+            copy.fiber = slot.fiber;
+            copy.level = slot.level;
+            copy.length = slot.length;
+            copy.size = std::min((size_t)slot.size, s_messageSize);
+            memcpy(copy.message, slot.message, copy.size);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (slot.seq.load(std::memory_order_relaxed) != n + 1) {
+                continue;
+            }
+
+            DumpLine line;
+            line.appendTime(copy.time, utc_offset);
+            line.append('\t');
+            line.append(LogLevel::ToString((LogLevel::Level)copy.level));
+            line.append('\t');
+            line.appendNumber(copy.thread);
+            line.append('\t');
+            line.appendNumber(copy.fiber);
+            line.append('\t');
+            line.append(copy.file ? copy.file : "?");
+            line.append(':');
+            line.appendNumber(copy.line);
+            line.append('\t');
+            line.append(copy.message, copy.size);
+            if (copy.length > copy.size) {
+                line.append("...");
+            }
+            line.append('\n');
+            if (!WriteAll(fd, line.data(), line.size())) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool FlightRecorder::dump (const char* path) const {
+    int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    bool ok = dump(fd);
+    ::close(fd);
+    return ok;
+}
+
+void FlightRecorder::OnCrash (int sig) {
+    // the first crashing thread dumps, SA_RESETHAND brought back the default action
+    static std::atomic<bool> s_dumped(false);
+    FlightRecorder* recorder = SltFlightRecorder::GetInstance();
+    if (!s_dumped.exchange(true) && recorder->m_crashFile[0]) {
+        recorder->dump(recorder->m_crashFile);
+    }
+    raise(sig);
+}
+
+void FlightRecorder::setCrashPath (const std::string& path) {
+    if (path.size() >= sizeof(m_crashFile)) {
+        std::cout << "FlightRecorder: crash path too long, " << path << std::endl;
+        return;
+    }
+    m_crashPath = path;
+    memcpy(m_crashFile, path.c_str(), path.size() + 1);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    if (path.empty()) {
+        sa.sa_handler = SIG_DFL;
+    }
+    else {
+        sa.sa_handler = &FlightRecorder::OnCrash;
+        sa.sa_flags = SA_RESETHAND | SA_ONSTACK;
+    }
+    for (int sig : s_crashSignals) {
+        sigaction(sig, &sa, nullptr);
+    }
+}
+
+/*
+ * --------------- Config ---------------
+ */
+struct FlightRecorderDefinition {
+    int level = LogLevel::OFF;
+    size_t events = 256;
+    std::string path;
+    bool operator== (const FlightRecorderDefinition& def) const {
+        return level == def.level &&
+               events == def.events &&
+               path == def.path;
+    }
+};
+
+template<>
+class FromNode<FlightRecorderDefinition> {
+public:
+    FlightRecorderDefinition operator() (const YAML::Node& node) {
+        FlightRecorderDefinition def;
+        if (node["level"].IsDefined()) {
+            def.level = LogLevel::FromString(node["level"].as<std::string>());
+        }
+        if (node["events"].IsDefined()) {
+            def.events = node["events"].as<size_t>();
+        }
+        if (node["path"].IsDefined()) {
+            def.path = node["path"].as<std::string>();
+        }
+        return def;
+    }
+};
+
+template<>
+class ToNode<FlightRecorderDefinition> {
+public:
+    YAML::Node operator() (const FlightRecorderDefinition& def) {
+        YAML::Node node;
+        node["level"] = LogLevel::ToString((LogLevel::Level)def.level);
+        node["events"] = def.events;
+        if (!def.path.empty()) {
+            node["path"] = def.path;
+        }
+        return node;
+    }
+};
+
+// the string forms, for the ConfigVar itself
+template<>
+class LexicalCast<std::string, FlightRecorderDefinition> {
+public:
+    FlightRecorderDefinition operator() (const std::string& str) {
+        return FromNode<FlightRecorderDefinition>() (YAML::Load(str));
+    }
+};
+
+template<>
+class LexicalCast<FlightRecorderDefinition, std::string> {
+public:
+    std::string operator() (const FlightRecorderDefinition& def) {
+        std::stringstream ss;
+        ss << ToNode<FlightRecorderDefinition>() (def);
+        return ss.str();
+    }
+};
+
+sylar::ConfigVar<FlightRecorderDefinition>::ptr g_flight_recorder =
+      sylar::Config::Lookup("flight_recorder", FlightRecorderDefinition(), "per-thread memory of the last log events");
+
+struct FlightRecorderIniter {
+    FlightRecorderIniter () {
+        g_flight_recorder->addListener([](const FlightRecorderDefinition& old_value,
+                                          const FlightRecorderDefinition& new_value) {
+            FlightRecorder* recorder = SltFlightRecorder::GetInstance();
+            recorder->setCapacity(new_value.events);
+            recorder->setLevel((LogLevel::Level)new_value.level);
+            if (new_value.path != old_value.path) {
+                recorder->setCrashPath(new_value.path);
+            }
+        });
+    }
+};
+
+static FlightRecorderIniter __flight_recorder_init;
+
+}
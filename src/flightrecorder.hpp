@@ -0,0 +1,80 @@
+#ifndef __FLIGHTRECORDER_H__
+#define __FLIGHTRECORDER_H__
+
+#include <cstdint>
+#include <string>
+#include <atomic>
+
+#include "log.hpp"
+
+namespace sylar {
+
+/*
+ * Keeps the last events of every thread in memory, whatever the levels of
+ * their loggers, so a crash dump shows the DEBUG lines leading up to it.
+ *
+ * Each thread writes to its own ring of fixed size slots: the event fields
+ * and the first bytes of the message are copied, nothing is formatted.
+ * A ring outlives its thread and is handed to the next new thread.
+ * While the recorder level is below a logger's level, the logger's
+ * statements down to the recorder level build their events, which are
+ * recorded and not passed to the appenders (see Logger::isEnabled).
+ *
+ * yaml:
+ *   flight_recorder:
+ *     level: DEBUG      # OFF (default) records nothing
+ *     events: 256       # per thread, rounded up to a power of 2
+ *     path: crash.log   # dump here on SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT
+ *
+ * dump() writes one text line per event, the events of one thread oldest
+ * first, and is async-signal-safe. File names are kept as pointers, so
+ * events have to come from the log macros (__FILE__ literals).
+ */
+class FlightRecorder {
+public:
+    // bytes of the message kept per event
+    static const size_t s_messageSize = 200;
+
+    FlightRecorder ();
+
+    LogLevel::Level getLevel () const { return (LogLevel::Level)m_level.load(std::memory_order_relaxed); }
+    // also updates the effective level of every logger of LoggerManager
+    void setLevel (LogLevel::Level level);
+    bool isEnabled (LogLevel::Level level) const { return level >= m_level.load(std::memory_order_relaxed); }
+    // events per thread, rings which already exist keep their size
+    size_t getCapacity () const { return m_capacity.load(std::memory_order_relaxed); }
+    void setCapacity (size_t events);
+
+    // copy the event into the calling thread's ring
+    void record (const LogEvent& event);
+
+    // async-signal-safe, return false if a write failed
+    bool dump (int fd) const;
+    bool dump (const char* path) const;
+    // dump to path on a crash signal, then die with the default action;
+    // an empty path restores the default handlers
+    void setCrashPath (const std::string& path);
+    const std::string& getCrashPath () const { return m_crashPath; }
+private:
+    struct Slot;
+    struct Ring;
+    struct LocalRing;
+    Ring* localRing ();
+    static void OnCrash (int sig);
+private:
+    std::atomic<int> m_level;
+    std::atomic<size_t> m_capacity;
+    // every ring so far, newest first, never freed
+    std::atomic<Ring*> m_rings;
+    // seconds east of UTC, taken when the level is set, used by dump()
+    std::atomic<long> m_utcOffset;
+    std::string m_crashPath;
+    // m_crashPath for the signal handler
+    char m_crashFile[256];
+};
+
+typedef Singleton<FlightRecorder> SltFlightRecorder;
+
+}
+
+#endif
@@ -1,5 +1,9 @@
 #include "log.hpp"
+#include <cmath>
+#include <deque>
 #include "config.hpp"
+#include "binlog.hpp"
+#include "flightrecorder.hpp"
 
 namespace sylar{
 /*
@@ -47,17 +51,54 @@ LogLevel::Level LogLevel::FromString(const std::string& str){
     return LogLevel::OFF;
 }
 
+/* 
+ * --------------- LogStreamBuf ---------------
+ */
+LogStreamBuf::int_type LogStreamBuf::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    reserve(1);
+    *pptr() = traits_type::to_char_type(c);
+    pbump(1);
+    return c;
+}
+
+std::streamsize LogStreamBuf::xsputn(const char* s, std::streamsize n) {
+    if (epptr() - pptr() < n) {
+        reserve(n);
+    }
+    memcpy(pptr(), s, n);
+    pbump(n);
+    return n;
+}
+
+void LogStreamBuf::reserve(size_t n) {
+    size_t used = size();
+    size_t capacity = epptr() - pbase();
+    if (capacity - used >= n) {
+        return;
+    }
+    capacity = std::max(capacity * 2, used + n);
+    std::unique_ptr<char[]> buf(new char[capacity]);
+    memcpy(buf.get(), pbase(), used);
+    m_heap.swap(buf);
+    setp(m_heap.get(), m_heap.get() + capacity);
+    pbump(used);
+}
+
 /* 
  * --------------- LogEvent ---------------
  */
-LogEvent::LogEvent (std::shared_ptr<Logger> logger,
+LogEvent::LogEvent (Logger* logger,
                     LogLevel::Level level, 
                     const char* filename, 
                     int32_t line, 
                     uint32_t threadID, 
                     uint32_t fiberID, 
                     uint32_t elapse, 
-                    uint32_t time)
+                    uint32_t time,
+                    uint32_t usec)
                     :m_logger(logger),
                      m_level(level),
                      m_filename(filename), 
@@ -65,9 +106,110 @@ LogEvent::LogEvent (std::shared_ptr<Logger> logger,
                      m_threadID(threadID), 
                      m_fiberID(fiberID), 
                      m_elapse(elapse), 
-                     m_time(time) {
-                        logger->setLevel(level);
-               }
+                     m_time(time),
+                     m_usec(usec),
+                     m_ss(&m_buf, &m_fields) {
+    setThreadName();
+}
+
+LogEvent::LogEvent (std::shared_ptr<Logger> logger,
+                    LogLevel::Level level, 
+                    const char* filename, 
+                    int32_t line, 
+                    uint32_t threadID, 
+                    uint32_t fiberID, 
+                    uint32_t elapse, 
+                    uint32_t time,
+                    uint32_t usec)
+: LogEvent(logger.get(), level, filename, line, threadID, fiberID, elapse, time, usec) {}
+
+void LogEvent::setThreadName () {
+    const ThreadIdentity& identity = GetThreadIdentity();
+    m_threadNameSize = identity.name_size;
+    memcpy(m_threadName, identity.name, sizeof(identity.name));
+    m_threadName[m_threadNameSize] = '\0';
+}
+
+void LogEvent::setThreadName (const std::string& name) {
+    m_threadNameSize = std::min(name.size(), sizeof(m_threadName) - 1);
+    memcpy(m_threadName, name.data(), m_threadNameSize);
+    m_threadName[m_threadNameSize] = '\0';
+}
+
+void LogEvent::reset (Logger* logger,
+                      LogLevel::Level level, 
+                      const char* filename, 
+                      int32_t line, 
+                      uint32_t threadID, 
+                      uint32_t fiberID, 
+                      uint32_t elapse, 
+                      uint32_t time,
+                      uint32_t usec) {
+    m_logger = logger;
+    m_level = level;
+    m_filename = filename;
+    m_line = line;
+    m_threadID = threadID;
+    m_fiberID = fiberID;
+    m_elapse = elapse;
+    m_time = time;
+    m_usec = usec;
+    setThreadName();
+    m_buf.clear();
+    m_fields.clear();
+    // undo whatever the previous user did to the stream
+    m_ss.clear();
+    m_ss.flags(std::ios_base::dec | std::ios_base::skipws);
+    m_ss.precision(6);
+    m_ss.width(0);
+    m_ss.fill(' ');
+}
+
+// free events of the current thread
+struct LogEventPool {
+    // enough for logging from inside an appender, keeps the pool small
+    static const size_t s_max_size = 16;
+    std::vector<LogEvent::ptr> events;
+    bool alive = true;
+    ~LogEventPool() { alive = false; }
+};
+static thread_local LogEventPool t_event_pool;
+
+LogEvent::ptr LogEvent::Acquire (const std::shared_ptr<Logger>& logger,
+                                 LogLevel::Level level, 
+                                 const char* filename, 
+                                 int32_t line, 
+                                 uint32_t threadID, 
+                                 uint32_t fiberID, 
+                                 uint32_t elapse,
+                                 const LogSite* site) {
+    uint64_t now = GetCurrentUS();
+    uint32_t time = now / 1000000;
+    uint32_t usec = now % 1000000;
+    LogEventPool& pool = t_event_pool;
+    LogEvent::ptr event;
+    if (!pool.alive || pool.events.empty()) {
+        event.reset(new LogEvent(logger.get(), level, filename, line, 
+                                 threadID, fiberID, elapse, time, usec));
+    }
+    else {
+        event = std::move(pool.events.back());
+        pool.events.pop_back();
+        event->reset(logger.get(), level, filename, line, threadID, fiberID, elapse, time, usec);
+    }
+    event->m_site = site;
+    return event;
+}
+
+void LogEvent::Release (LogEvent::ptr& event) {
+    LogEventPool& pool = t_event_pool;
+    // still referenced (e.g. kept by an appender), leave it to shared_ptr
+    if (pool.alive && event.unique() && pool.events.size() < LogEventPool::s_max_size) {
+        pool.events.push_back(std::move(event));
+    }
+    event.reset();
+}
+
 void LogEvent::format(const char* fmt, ...){
     va_list al;
     va_start(al, fmt); // allow to visit 
@@ -75,32 +217,296 @@ void LogEvent::format(const char* fmt, ...){
     va_end(al);
 }
 void LogEvent::format(const char* fmt, va_list al){
-    char* buf = nullptr;
-    int len = vasprintf(&buf, fmt, al);
-    if (len != -1){
-        m_ss << std::string (buf, len);
-        free (buf);
+    // print into the buffer, grow it and print again if it was too small
+    va_list copy;
+    va_copy(copy, al);
+    int len = vsnprintf(m_buf.tail(), m_buf.available(), fmt, copy);
+    va_end(copy);
+    if (len < 0) {
+        return;
+    }
+    if ((size_t)len >= m_buf.available()) {
+        // vsnprintf also writes the '\0'
+        m_buf.reserve(len + 1);
+        vsnprintf(m_buf.tail(), m_buf.available(), fmt, al);
+    }
+    m_buf.commit(len);
+}
+
+/*
+ * --------------- FmtWrite ---------------
+ */
+const char* FmtLiteral(LogStreamBuf& buf, const char* fmt) {
+    const char* begin = fmt;
+    for (;; ++fmt) {
+        char c = *fmt;
+        if (c == '\0') {
+            buf.append(begin, fmt - begin);
+            return nullptr;
+        }
+        if (c != '{' && c != '}') {
+            continue;
+        }
+        if (fmt[1] == c) {
+            // "{{" or "}}"
+            buf.append(begin, fmt + 1 - begin);
+            begin = ++fmt + 1;
+        }
+        else if (c == '{' && fmt[1] == '}') {
+            buf.append(begin, fmt - begin);
+            return fmt + 2;
+        }
+    }
+}
+
+static const char s_digits[] = 
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void FmtAppendUInt(LogStreamBuf& buf, uint64_t value) {
+    char tmp[24];
+    char* end = tmp + sizeof(tmp);
+    char* p = end;
+    // two digits per division
+    while (value >= 100) {
+        unsigned i = (value % 100) * 2;
+        value /= 100;
+        *--p = s_digits[i + 1];
+        *--p = s_digits[i];
+    }
+    if (value >= 10) {
+        unsigned i = value * 2;
+        *--p = s_digits[i + 1];
+        *--p = s_digits[i];
+    }
+    else {
+        *--p = '0' + value;
+    }
+    buf.append(p, end - p);
+}
+
+void FmtAppendInt(LogStreamBuf& buf, int64_t value) {
+    if (value < 0) {
+        buf.append("-", 1);
+        FmtAppendUInt(buf, -(uint64_t)value);
+        return;
+    }
+    FmtAppendUInt(buf, value);
+}
+
+void FmtAppendHex(LogStreamBuf& buf, uint64_t value) {
+    char tmp[16];
+    char* end = tmp + sizeof(tmp);
+    char* p = end;
+    do {
+        *--p = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value);
+    buf.append(p, end - p);
+}
+
+static const double s_pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9 };
+
+/*
+ * Fast path for values with few decimals (3.25, 0.1, 1500): the smallest k
+ * for which round(|value| * 10^k) / 10^k gives back |value| exactly. 
+ * The division is correctly rounded like strtod(), so the text reads back 
+ * to the same value. Returns 0 for anything else.
+ */
+static size_t FmtFixed(char* out, double value, bool single) {
+    double a = fabs(value);
+    if (!(a >= 1e-4 && a < 1e15)) {
+        return 0;
+    }
+    for (int k = 0; k < 10; ++k) {
+        double scaled = a * s_pow10[k];
+        if (scaled >= 9007199254740992.0) {
+            // past 2^53
+            return 0;
+        }
+        uint64_t n = (uint64_t)(scaled + 0.5);
+        double back = (double)n / s_pow10[k];
+        if (single ? (float)back != (float)a : back != a) {
+            continue;
+        }
+        char tmp[32];
+        char* end = tmp + sizeof(tmp);
+        char* p = end;
+        for (int i = 0; i < k || n || p > end - k - 1; ++i) {
+            if (i == k && k) {
+                *--p = '.';
+            }
+            *--p = '0' + n % 10;
+            n /= 10;
+        }
+        if (value < 0) {
+            *--p = '-';
+        }
+        memcpy(out, p, end - p);
+        return end - p;
+    }
+    return 0;
+}
+
+size_t FmtDouble(char* out, double value, bool single) {
+    size_t len = FmtFixed(out, value, single);
+    if (len) {
+        return len;
+    }
+    // the shortest %g text which reads back to the same value
+    int precision = single ? 6 : 15;
+    int max_precision = single ? 9 : 17;
+    for (; ; ++precision) {
+        len = snprintf(out, 32, "%.*g", precision, value);
+        if (precision == max_precision 
+                || (single ? strtof(out, nullptr) == (float)value : strtod(out, nullptr) == value)) {
+            break;
+        }
     }
+    return len;
+}
+
+void FmtAppend(LogStreamBuf& buf, double value) {
+    char tmp[32];
+    buf.append(tmp, FmtDouble(tmp, value, false));
+}
+
+void FmtAppend(LogStreamBuf& buf, float value) {
+    char tmp[32];
+    buf.append(tmp, FmtDouble(tmp, value, true));
 }
 
 /* 
  * --------------- LogEventWrap ---------------
  */
-LogEventWrap::LogEventWrap(LogEvent::ptr e)
-: m_event(e){}
+LogEventWrap::LogEventWrap(LogEvent::ptr&& e)
+: m_event(std::move(e)){}
 
 LogEventWrap::~LogEventWrap(){
     m_event->getLogger()->log(m_event->getLevel(), m_event);
+    LogEvent::Release(m_event);
 }
 
-std::stringstream& LogEventWrap::getSS() {
+LogStream& LogEventWrap::getSS() {
     return m_event->getSS();
 }
 
-LogEvent::ptr LogEventWrap::getEvent(){
+const LogEvent::ptr& LogEventWrap::getEvent(){
     return m_event;
 }
 
+/* 
+ * --------------- DateTimeCache ---------------
+ *  localtime_r and strftime only run when the second changes, 
+ *  one cache entry per time format used by the thread.
+ *  "%ms" and "%us" in a time format are kept as digit slots 
+ *  in the cached text and patched for every event.
+ */
+class DateTimeCache {
+public:
+    static void Append(std::string& out, const char* fmt, time_t sec, uint32_t usec);
+private:
+    struct Slot {
+        size_t pos;
+        int digits; // 3 for "%ms", 6 for "%us"
+    };
+    struct Entry {
+        std::string fmt;
+        time_t sec = -1;
+        std::string text;
+        std::vector<Slot> slots;
+        void rebuild(time_t time);
+    };
+    static const size_t s_entries = 4;
+};
+
+static void AppendPadded(std::string& out, uint32_t value, int digits) {
+    char buf[16];
+    for (int i = digits - 1; i >= 0; --i) {
+        buf[i] = '0' + value % 10;
+        value /= 10;
+    }
+    out.append(buf, digits);
+}
+
+static void AppendStrftime(std::string& out, const std::string& fmt, const struct tm& tm) {
+    if (fmt.empty()) {
+        return;
+    }
+    char buf[128];
+    size_t len = strftime(buf, sizeof(buf), fmt.c_str(), &tm);
+    out.append(buf, len);
+}
+
+void DateTimeCache::Entry::rebuild(time_t time) {
+    struct tm tm;
+    localtime_r(&time, &tm);
+    sec = time;
+    text.clear();
+    slots.clear();
+    std::string segment;
+    for (size_t i = 0; i < fmt.size(); ++i) {
+        if (fmt[i] != '%' || i + 1 == fmt.size()) {
+            segment.push_back(fmt[i]);
+            continue;
+        }
+        if ((fmt[i + 1] == 'm' || fmt[i + 1] == 'u') 
+                && i + 2 < fmt.size() && fmt[i + 2] == 's') {
+            AppendStrftime(text, segment, tm);
+            segment.clear();
+            Slot slot;
+            slot.pos = text.size();
+            slot.digits = fmt[i + 1] == 'm' ? 3 : 6;
+            slots.push_back(slot);
+            text.append(slot.digits, '0');
+            i += 2;
+            continue;
+        }
+        // keep the conversion (and "%%") for strftime
+        segment.append(fmt, i, 2);
+        ++i;
+    }
+    AppendStrftime(text, segment, tm);
+}
+
+void DateTimeCache::Append(std::string& out, const char* fmt, time_t sec, uint32_t usec) {
+    static thread_local Entry t_entries[s_entries];
+    static thread_local size_t t_next = 0;
+    Entry* entry = nullptr;
+    for (size_t i = 0; i < s_entries; ++i) {
+        if (t_entries[i].fmt == fmt) {
+            entry = &t_entries[i];
+            break;
+        }
+    }
+    if (!entry) {
+        entry = &t_entries[t_next];
+        t_next = (t_next + 1) % s_entries;
+        entry->fmt = fmt;
+        entry->sec = -1;
+    }
+    if (entry->sec != sec) {
+        entry->rebuild(sec);
+    }
+    size_t base = out.size();
+    out.append(entry->text);
+    for (auto& slot : entry->slots) {
+        uint32_t value = slot.digits == 3 ? usec / 1000 : usec;
+        for (int i = slot.digits - 1; i >= 0; --i) {
+            out[base + slot.pos + i] = '0' + value % 10;
+            value /= 10;
+        }
+    }
+}
+
 /* 
  * --------------- FormatItem ---------------
  */
@@ -108,7 +514,12 @@ class MessageFormatItem : public LogFormatter::FormatItem{
 public:
     MessageFormatItem (const std::string& format = ""){ }
     virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-        os << event->getContent();
+        os.write(event->getContentData(), event->getContentSize());
+        if (!event->getFields().empty()) {
+            std::string fields(" ");
+            LogFormatter::AppendFields(fields, event->getFields(), LogFormatter::STYLE_TEXT, true);
+            os << fields;
+        }
     }
 };
 
@@ -134,7 +545,15 @@ class ThreadIDFormatItem : public LogFormatter::FormatItem{
 public:
     ThreadIDFormatItem (const std::string& format = ""){ }
     virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-        os << GetThreadID();
+        os << event->getThreadID();
+    }
+};
+
+class ThreadNameFormatItem : public LogFormatter::FormatItem{
+public:
+    ThreadNameFormatItem (const std::string& format = ""){ }
+    virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
+        os.write(event->getThreadName(), event->getThreadNameSize());
     }
 };
 
@@ -155,17 +574,34 @@ public:
         }
     }
     virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
-        struct tm tm;
-        time_t time = event->getTime();
-        localtime_r(&time, &tm);
-        char buf[64];
-        strftime(buf, sizeof(buf), m_format.c_str(), &tm);
-        os << buf;
+        std::string str;
+        DateTimeCache::Append(str, m_format.c_str(), event->getTime(), event->getUsec());
+        os << str;
     }
 private:
     std::string m_format;
 };
 
+class MilliSecondFormatItem : public LogFormatter::FormatItem{
+public:
+    MilliSecondFormatItem (const std::string& format = ""){ }
+    virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
+        std::string str;
+        AppendPadded(str, event->getUsec() / 1000, 3);
+        os << str;
+    }
+};
+
+class MicroSecondFormatItem : public LogFormatter::FormatItem{
+public:
+    MicroSecondFormatItem (const std::string& format = ""){ }
+    virtual void format(std::ostream& os, LogLevel::Level level, LogEvent::ptr event) override{
+        std::string str;
+        AppendPadded(str, event->getUsec(), 6);
+        os << str;
+    }
+};
+
 class FileNameFormatItem : public LogFormatter::FormatItem{
 public:
     FileNameFormatItem (const std::string& format = ""){ }
@@ -214,8 +650,8 @@ private:
  * --------------- LogFormatter ---------------
 */
 
-LogFormatter::LogFormatter(const std::string& pattern)
-: m_pattern(pattern){
+LogFormatter::LogFormatter(const std::string& pattern, Style style)
+: m_pattern(pattern), m_style(style) {
     if (pattern.empty()){
         // If no given pattern, 
         // it will be initialized with following pattern 
@@ -226,6 +662,10 @@ LogFormatter::LogFormatter(const std::string& pattern)
 }
 
 void LogFormatter::parse() {
+    m_ops.clear();
+    m_literals.clear();
+    m_items.clear();
+    m_error = false;
     // Parse the format pattern
     std::vector<std::tuple<std::string, std::string, int>> vec;
     std::string text;
@@ -305,51 +745,178 @@ void LogFormatter::parse() {
     * %p -- level
     * %r -- elapse from starting
     * %t -- threadID
+    * %N -- thread name
+    * %F -- fiberID
     * %n -- newline
-    * %d -- time
+    * %d -- time, "%ms"/"%us" may be used in its format
+    * %ms -- milliseconds (3 digits)
+    * %us -- microseconds (6 digits)
     * %f -- filename
     * %l -- linenumber
     * %T -- tab
     */
-    static std::map<std::string, std::function<FormatItem::ptr(const std::string)> > s_format_items = {
-        {"m", [](const std::string& fmt){ return FormatItem::ptr(new MessageFormatItem(fmt)); }},
-        {"p", [](const std::string& fmt){ return FormatItem::ptr(new LevelFormatItem(fmt)); }},
-        {"r", [](const std::string& fmt){ return FormatItem::ptr(new ElapseFormatItem(fmt)); }},
-        {"t", [](const std::string& fmt){ return FormatItem::ptr(new ThreadIDFormatItem(fmt)); }},
-        {"n", [](const std::string& fmt){ return FormatItem::ptr(new NewLineFormatItem(fmt)); }},
-        {"d", [](const std::string& fmt){ return FormatItem::ptr(new DateTimeFormatItem(fmt)); }},
-        {"f", [](const std::string& fmt){ return FormatItem::ptr(new FileNameFormatItem(fmt)); }},
-        {"l", [](const std::string& fmt){ return FormatItem::ptr(new LineNumberFormatItem(fmt)); }},
-        {"T", [](const std::string& fmt){ return FormatItem::ptr(new TabFormatItem(fmt)); }}
+    typedef std::function<FormatItem::ptr(const std::string)> ItemFactory;
+    static std::map<std::string, std::pair<OpCode, ItemFactory> > s_format_items = {
+        {"m", {OP_MESSAGE,   [](const std::string& fmt){ return FormatItem::ptr(new MessageFormatItem(fmt)); }}},
+        {"p", {OP_LEVEL,     [](const std::string& fmt){ return FormatItem::ptr(new LevelFormatItem(fmt)); }}},
+        {"r", {OP_ELAPSE,    [](const std::string& fmt){ return FormatItem::ptr(new ElapseFormatItem(fmt)); }}},
+        {"t", {OP_THREAD_ID, [](const std::string& fmt){ return FormatItem::ptr(new ThreadIDFormatItem(fmt)); }}},
+        {"N", {OP_THREAD_NAME, [](const std::string& fmt){ return FormatItem::ptr(new ThreadNameFormatItem(fmt)); }}},
+        {"F", {OP_FIBER_ID,  [](const std::string& fmt){ return FormatItem::ptr(new FiberIDFormatItem(fmt)); }}},
+        {"n", {OP_NEWLINE,   [](const std::string& fmt){ return FormatItem::ptr(new NewLineFormatItem(fmt)); }}},
+        {"d", {OP_DATETIME,  [](const std::string& fmt){ return FormatItem::ptr(new DateTimeFormatItem(fmt)); }}},
+        {"f", {OP_FILENAME,  [](const std::string& fmt){ return FormatItem::ptr(new FileNameFormatItem(fmt)); }}},
+        {"l", {OP_LINE,      [](const std::string& fmt){ return FormatItem::ptr(new LineNumberFormatItem(fmt)); }}},
+        {"T", {OP_TAB,       [](const std::string& fmt){ return FormatItem::ptr(new TabFormatItem(fmt)); }}},
+        {"ms", {OP_MSEC,     [](const std::string& fmt){ return FormatItem::ptr(new MilliSecondFormatItem(fmt)); }}},
+        {"us", {OP_USEC,     [](const std::string& fmt){ return FormatItem::ptr(new MicroSecondFormatItem(fmt)); }}}
     };
     
     for (auto& i : vec) {
         if (std::get<2>(i) == 0) {
             // text information
             m_items.push_back(FormatItem::ptr(new StringFormatItem(std::get<0>(i))));
+            addOp(OP_STRING, std::get<0>(i));
         }
         else {
             auto it = s_format_items.find(std::get<0>(i));
             if (it == s_format_items.end()) {
                 // No found
-                m_items.push_back(FormatItem::ptr(new StringFormatItem("<<error_format %" + std::get<0>(i) + ">>")));
+                std::string error = "<<error_format %" + std::get<0>(i) + ">>";
+                m_items.push_back(FormatItem::ptr(new StringFormatItem(error)));
+                addOp(OP_STRING, error);
                 m_error = true;
             }
             else {
-                m_items.push_back(it->second(std::get<1>(i)));
+                m_items.push_back(it->second.second(std::get<1>(i)));
+                if (it->second.first == OP_DATETIME) {
+                    addOp(OP_DATETIME, std::get<1>(i).empty() ? "%Y-%m-%d %H:%M:%S" : std::get<1>(i));
+                }
+                else {
+                    addOp(it->second.first);
+                }
+                if (it->second.first == OP_MESSAGE && m_style == STYLE_TEXT) {
+                    // " key=value" for each kv() field
+                    addOp(OP_FIELDS);
+                    m_ops.back().offset = 0;
+                }
             }
         }
         //std::cout << std::get<0>(i) << " - " << std::get<1>(i) << " - " << std::get<2>(i) << std::endl;
     }
+    if (m_style != STYLE_TEXT) {
+        compileStructured();
+    }
+}
+
+void LogFormatter::addOp(OpCode code, const std::string& literal) {
+    Op op;
+    op.code = code;
+    op.offset = m_literals.size();
+    op.length = literal.size();
+    // keep literals null-terminated for strftime
+    m_literals.append(literal);
+    m_literals.push_back('\0');
+    m_ops.push_back(op);
+}
+
+static void AppendUInt(std::string& out, uint64_t value) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    out.append(p, end - p);
+}
+
+static void AppendInt(std::string& out, int64_t value) {
+    if (value < 0) {
+        out.push_back('-');
+        AppendUInt(out, -(uint64_t)value);
+        return;
+    }
+    AppendUInt(out, value);
+}
+
+void LogFormatter::format(std::string& out, const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) {
+    const char* literals = m_literals.data();
+    for (auto& op : m_ops) {
+        switch (op.code) {
+            case OP_STRING:
+                out.append(literals + op.offset, op.length); break;
+            case OP_MESSAGE:
+                out.append(event->getContentData(), event->getContentSize()); 
+                break;
+            case OP_LEVEL:
+                out.append(LogLevel::ToString(event->getLevel())); break;
+            case OP_ELAPSE:
+                AppendUInt(out, event->getElapse()); break;
+            case OP_THREAD_ID:
+                AppendUInt(out, event->getThreadID()); break;
+            case OP_THREAD_NAME:
+                out.append(event->getThreadName(), event->getThreadNameSize()); break;
+            case OP_FIBER_ID:
+                AppendUInt(out, event->getFiberID()); break;
+            case OP_DATETIME:
+                DateTimeCache::Append(out, literals + op.offset, event->getTime(), event->getUsec()); 
+                break;
+            case OP_FILENAME:
+                out.append(event->getFileName()); break;
+            case OP_LINE:
+                AppendInt(out, event->getLineNumber()); break;
+            case OP_NEWLINE:
+                out.push_back('\n'); break;
+            case OP_TAB:
+                out.push_back('\t'); break;
+            case OP_MSEC:
+                AppendPadded(out, event->getUsec() / 1000, 3); break;
+            case OP_USEC:
+                AppendPadded(out, event->getUsec(), 6); break;
+            case OP_FIELDS:
+                if (!event->getFields().empty()) {
+                    formatStructured(out, op, event);
+                }
+                break;
+            case OP_MESSAGE_VALUE:
+            case OP_FILENAME_VALUE:
+            case OP_THREAD_NAME_VALUE:
+                formatStructured(out, op, event); break;
+            case OP_DATETIME_VALUE: {
+                // the time pattern is the user's, it may hold quotes or %n
+                size_t begin = out.size();
+                DateTimeCache::Append(out, literals + op.offset, event->getTime(), event->getUsec()); 
+                EscapeFrom(out, begin);
+                break;
+            }
+            default:
+                break;
+        }
+    }
 }
 
-std::string LogFormatter::format (std::shared_ptr<Logger> logger_ptr, LogEvent::ptr event){
-    std::stringstream ss; 
-    LogLevel::Level level = logger_ptr->getLevel();
+const std::string& LogFormatter::formatLocal(const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) {
+    static thread_local std::string t_buffer;
+    t_buffer.clear();
+    format(t_buffer, logger_ptr, event);
+    return t_buffer;
+}
+
+std::string LogFormatter::format (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event){
+    std::string str;
+    format(str, logger_ptr, event);
+    return str;
+}
+
+std::ostream& LogFormatter::format (std::ostream& os, const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event){
+    if (m_style != STYLE_TEXT) {
+        return os << formatLocal(logger_ptr, event);
+    }
     for (auto& i: m_items){
-        i->format(ss, level, event);
+        i->format(os, event->getLevel(), event);
     }
-    return ss.str();
+    return os;
 }
 
 /*
@@ -361,6 +928,66 @@ std::string LogFormatter::format (std::shared_ptr<Logger> logger_ptr, LogEvent::
  *  However, only Logger can control the level, so we set the appender level to the lowest. 
  */
 
+/*
+ * The texts of the event being handed out, one per formatter. The frames
+ * are per thread and per nesting depth: a log call made from inside an 
+ * appender formats into the next frame and leaves the outer texts alone.
+ * The strings keep their capacity, the formatter refs go with the scope.
+ */
+class FormattedEvent {
+public:
+    FormattedEvent ();
+    ~FormattedEvent ();
+    const std::string& get (const LogFormatter::ptr& formatter, const std::shared_ptr<Logger>& logger, 
+                            const LogEvent::ptr& event);
+private:
+    struct Entry {
+        LogFormatter::ptr formatter;
+        std::string text;
+    };
+    struct Frame {
+        std::vector<Entry> entries;
+        size_t used = 0;
+    };
+    // a deque: entering a deeper frame moves none of the outer ones
+    static thread_local std::deque<Frame> t_frames;
+    static thread_local size_t t_depth;
+    Frame& m_frame;
+};
+
+thread_local std::deque<FormattedEvent::Frame> FormattedEvent::t_frames;
+thread_local size_t FormattedEvent::t_depth = 0;
+
+FormattedEvent::FormattedEvent ()
+: m_frame(t_depth < t_frames.size() ? t_frames[t_depth] : (t_frames.emplace_back(), t_frames.back())) {
+    ++t_depth;
+}
+
+FormattedEvent::~FormattedEvent () {
+    for (size_t i = 0; i < m_frame.used; ++i) {
+        m_frame.entries[i].formatter.reset();
+    }
+    m_frame.used = 0;
+    --t_depth;
+}
+
+const std::string& FormattedEvent::get (const LogFormatter::ptr& formatter, const std::shared_ptr<Logger>& logger, 
+                                        const LogEvent::ptr& event) {
+    for (size_t i = 0; i < m_frame.used; ++i) {
+        if (m_frame.entries[i].formatter == formatter) {
+            return m_frame.entries[i].text;
+        }
+    }
+    if (m_frame.used == m_frame.entries.size()) {
+        m_frame.entries.emplace_back();
+    }
+    Entry& entry = m_frame.entries[m_frame.used++];
+    entry.formatter = formatter;
+    entry.text.clear();
+    formatter->format(entry.text, logger, event);
+    return entry.text;
+}
+
 void LogAppender::setFormatter(LogFormatter::ptr formatter) { 
     MutexType::Lock lock(m_mutex);
     m_formatter = formatter;
@@ -371,22 +998,35 @@ LogFormatter::ptr LogAppender::getFormatter() {
     return m_formatter; 
 }
 
-void StdoutLogAppender::log (std::shared_ptr<Logger> logger_ptr,LogEvent::ptr event){
+void StdoutLogAppender::log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event){
     // print to consoler
-    if (m_formatter){
-        MutexType::Lock lock(m_mutex);
-        std::cout << m_formatter->format(logger_ptr, event);
+    if (LogFormatter::ptr formatter = getFormatter()){
+        FormattedEvent formatted;
+        write(formatted.get(formatter, logger_ptr, event));
     }else {
         std::cout << "No formatter" << std::endl;
     }
 }
 
+void StdoutLogAppender::write (const std::string& msg) {
+    MutexType::Lock lock(m_mutex);
+    std::cout << msg;
+}
+
+void StdoutLogAppender::flush () {
+    MutexType::Lock lock(m_mutex);
+    std::cout.flush();
+}
+
 std::string StdoutLogAppender::toYamlString() {
     MutexType::Lock lock(m_mutex);
     YAML::Node node;
     node["type"] = "StdoutLogAppender";
     if (m_formatter){
         node["pattern"] = m_formatter->getPattern();
+        if (m_formatter->getStyle() != LogFormatter::STYLE_TEXT) {
+            node["format"] = LogFormatter::StyleToString(m_formatter->getStyle());
+        }
     }
     std::stringstream ss;
     ss << node;
@@ -394,7 +1034,6 @@ std::string StdoutLogAppender::toYamlString() {
 }
 
 void StdoutLogAppender::setFormatter (const std::string& pattern) {
-    MutexType::Lock lock(m_mutex);
     LogFormatter::ptr new_fmt (new LogFormatter(pattern));
     if (new_fmt->isError()) { // check
         std::cout << "StdoutLogAppender value=" 
@@ -405,35 +1044,36 @@ void StdoutLogAppender::setFormatter (const std::string& pattern) {
     setFormatter(new_fmt);
 }
 
-FileLogAppender::FileLogAppender (const std::string& filename)
+FileLogAppender::FileLogAppender (const std::string& filename, const LogFile::Options& options,
+                                  const LogFile::ptr& previous)
 : m_filename(filename) {
-    m_filestream.open(m_filename);
-    if (!m_filestream.is_open()){
+    m_file = LogFile::Open(m_filename, options, previous);
+    if (!m_file->isOpen()){
         // TODO: exception dealing
         std::cout << "File opening failed. " << std::endl;
         exit(1);
     }
 }
 
-void FileLogAppender::log (std::shared_ptr<Logger> logger_ptr, LogEvent::ptr event) {
-    // TODO: reopen file to check
-    MutexType::Lock lock(m_mutex);
-    if (!(m_filestream << m_formatter->format(logger_ptr, event))) {
-        std::cout << "FileLogAppender log error" << std::endl;
-    }
+void FileLogAppender::log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) {
+    FormattedEvent formatted;
+    write(formatted.get(getFormatter(), logger_ptr, event));
+}
+
+void FileLogAppender::write (const std::string& msg) {
+    // LogFile has its own lock
+    m_file->append(msg.data(), msg.size());
+}
+
+void FileLogAppender::flush () {
+    m_file->flush();
 }
 
 bool FileLogAppender::reopen (){
-    MutexType::Lock lock(m_mutex);
-    if (m_filestream){
-        m_filestream.close();
-    }
-    m_filestream.open(m_filename);
-    return m_filestream.is_open();
+    return m_file->reopen();
 }
 
 void FileLogAppender::setFormatter (const std::string& pattern) {
-    MutexType::Lock lock(m_mutex);
     LogFormatter::ptr new_fmt (new LogFormatter(pattern));
     if (new_fmt->isError()) { // check
         std::cout << "FileLogAppender value=" 
@@ -451,50 +1091,400 @@ std::string FileLogAppender::toYamlString() {
     node["file"] = m_filename;
     if (m_formatter){
         node["pattern"] = m_formatter->getPattern();
+        if (m_formatter->getStyle() != LogFormatter::STYLE_TEXT) {
+            node["format"] = LogFormatter::StyleToString(m_formatter->getStyle());
+        }
+    }
+    const LogFile::Options& options = m_file->getOptions();
+    node["buffer_size"] = options.buffer_size;
+    node["flush_interval"] = options.flush_interval;
+    node["sync"] = LogFile::SyncToString(options.sync);
+    if (options.sync == LogFile::SYNC_INTERVAL) {
+        node["sync_interval"] = options.sync_interval;
+    }
+    else if (options.sync == LogFile::SYNC_BYTES) {
+        node["sync_bytes"] = options.sync_bytes;
+    }
+    if (options.max_size) {
+        node["max_size"] = options.max_size;
+    }
+    if (options.rotate_interval) {
+        node["rotate"] = LogFile::IntervalToString(options.rotate_interval);
+    }
+    if (options.max_size || options.rotate_interval) {
+        node["max_files"] = options.max_files;
+        node["compress"] = options.compress;
     }
     std::stringstream ss;
     ss << node;
     return ss.str();
 }
 
+MmapFileLogAppender::MmapFileLogAppender (const std::string& filename, 
+                                          const MmapLogFile::Options& options)
+: m_filename(filename) {
+    m_file = MmapLogFile::Open(m_filename, options);
+    if (!m_file->isOpen()){
+        std::cout << "File opening failed. " << std::endl;
+        exit(1);
+    }
+}
+
+void MmapFileLogAppender::log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) {
+    FormattedEvent formatted;
+    write(formatted.get(getFormatter(), logger_ptr, event));
+}
+
+void MmapFileLogAppender::write (const std::string& msg) {
+    // lock free
+    m_file->append(msg.data(), msg.size());
+}
+
+void MmapFileLogAppender::flush () {
+    m_file->flush();
+}
+
+void MmapFileLogAppender::setFormatter (const std::string& pattern) {
+    LogFormatter::ptr new_fmt (new LogFormatter(pattern));
+    if (new_fmt->isError()) { // check
+        std::cout << "MmapFileLogAppender value=" 
+                  << pattern << " invalid pattern. " 
+                  << std::endl;
+        return;
+    }
+    setFormatter(new_fmt);
+}
+
+std::string MmapFileLogAppender::toYamlString() {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    node["type"] = "MmapFileLogAppender";
+    node["file"] = m_filename;
+    if (m_formatter){
+        node["pattern"] = m_formatter->getPattern();
+        if (m_formatter->getStyle() != LogFormatter::STYLE_TEXT) {
+            node["format"] = LogFormatter::StyleToString(m_formatter->getStyle());
+        }
+    }
+    const MmapLogFile::Options& options = m_file->getOptions();
+    node["chunk_size"] = options.chunk_size;
+    node["flush_interval"] = options.flush_interval;
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+/*
+ * --------------- AsyncLogAppender ---------------
+ *  Producers (any thread calling log) format the event and push the text 
+ *  into m_ring. The background thread pops records, joins them into one 
+ *  batch and writes the batch to the backend appender with a single call.
+ *  The background thread sleeps on m_semaphore when the ring is empty, 
+ *  producers only post the semaphore if m_sleeping is set.
+ */
+static const size_t s_async_batch_size = 256;
+
+const char* AsyncLogAppender::PolicyToString(AsyncLogAppender::OverflowPolicy policy) {
+    switch (policy) {
+        case AsyncLogAppender::BLOCK:
+            return "block"; break;
+        case AsyncLogAppender::DROP:
+            return "drop"; break;
+        case AsyncLogAppender::DROP_COUNT:
+            return "drop_count"; break;
+        default:
+            return "block";
+    }
+    return "block";
+}
+
+AsyncLogAppender::OverflowPolicy AsyncLogAppender::PolicyFromString(const std::string& str) {
+    if (str == "drop") {
+        return AsyncLogAppender::DROP;
+    }
+    if (str == "drop_count") {
+        return AsyncLogAppender::DROP_COUNT;
+    }
+    return AsyncLogAppender::BLOCK;
+}
+
+AsyncLogAppender::AsyncLogAppender (LogAppender::ptr backend, 
+                                    size_t capacity, 
+                                    OverflowPolicy policy)
+: m_backend(backend), 
+  m_policy(policy), 
+  m_ring(capacity),
+  m_sleeping(false),
+  m_stopping(false),
+  m_written(0),
+  m_dropped(0),
+  m_unreported(0),
+  m_pushers(0) {
+    m_formatter = m_backend->getFormatter();
+    m_thread.reset(new Thread(std::bind(&AsyncLogAppender::run, this), "log_async"));
+}
+
+AsyncLogAppender::~AsyncLogAppender () {
+    stop();
+}
+
+void AsyncLogAppender::log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) {
+    if (LogFormatter::ptr formatter = getFormatter()){
+        FormattedEvent formatted;
+        push(formatted.get(formatter, logger_ptr, event));
+    }else {
+        std::cout << "No formatter" << std::endl;
+    }
+}
+
+void AsyncLogAppender::write (const std::string& msg) {
+    push(msg);
+}
+
+void AsyncLogAppender::push (const std::string& msg) {
+    // counted before m_stopping is read: stop() sets m_stopping, then waits
+    // for the count to drop to zero before its last drain of the ring
+    ++m_pushers;
+    bool queued = enqueue(msg);
+    --m_pushers;
+    if (!queued) {
+        // the background thread is gone, write through
+        m_backend->write(msg);
+    }
+}
+
+bool AsyncLogAppender::enqueue (const std::string& msg) {
+    if (m_stopping) {
+        return false;
+    }
+    // copied into the slot string, which keeps its capacity between uses
+    while (!m_ring.tryPush(msg)) {
+        if (m_policy == BLOCK) {
+            if (m_stopping) {
+                return false;
+            }
+            wakeup();
+            sched_yield();
+            continue;
+        }
+        ++m_dropped;
+        if (m_policy == DROP_COUNT) {
+            ++m_unreported;
+        }
+        return true;
+    }
+    wakeup();
+    return true;
+}
+
+void AsyncLogAppender::wakeup () {
+    if (m_sleeping.load() && m_sleeping.exchange(false)) {
+        m_semaphore.notify();
+    }
+}
+
+void AsyncLogAppender::flush () {
+    uint64_t target = m_ring.pushed();
+    while (!m_stopping && m_written.load() < target) {
+        wakeup();
+        usleep(100);
+    }
+    m_backend->flush();
+}
+
+void AsyncLogAppender::stop () {
+    if (m_stopping.exchange(true)) {
+        return;
+    }
+    m_semaphore.notify();
+    m_thread->join();
+    // a push() which read m_stopping before it was set may still be queuing
+    while (m_pushers.load()) {
+        sched_yield();
+    }
+    // records pushed while the background thread was leaving
+    std::string record;
+    while (m_ring.tryPop(record)) {
+        m_backend->write(record);
+    }
+    m_backend->flush();
+}
+
+void AsyncLogAppender::run () {
+    std::string batch;
+    auto append = [&batch](const std::string& record) { batch.append(record); };
+    for (;;) {
+        size_t count = 0;
+        while (count < s_async_batch_size && m_ring.tryConsume(append)) {
+            ++count;
+        }
+        if (m_unreported.load() && m_policy == DROP_COUNT) {
+            batch.append("AsyncLogAppender dropped " 
+                         + std::to_string(m_unreported.exchange(0)) 
+                         + " messages\n");
+        }
+        if (!batch.empty()) {
+            m_backend->write(batch);
+            batch.clear();
+        }
+        m_written.store(m_ring.popped());
+        if (count) {
+            continue;
+        }
+        if (!m_ring.empty()) {
+            // a producer claimed a slot but has not filled it yet
+            sched_yield();
+            continue;
+        }
+        if (m_stopping) {
+            break;
+        }
+        // check the ring again after announcing the sleep, 
+        // a producer either sees m_sleeping or its record is seen here
+        m_sleeping.store(true);
+        if (!m_ring.empty() || m_stopping) {
+            m_sleeping.store(false);
+            continue;
+        }
+        m_semaphore.wait();
+    }
+}
+
+void AsyncLogAppender::setFormatter (LogFormatter::ptr formatter) {
+    LogAppender::setFormatter(formatter);
+    m_backend->setFormatter(formatter);
+}
+
+void AsyncLogAppender::setFormatter (const std::string& pattern) {
+    LogFormatter::ptr new_fmt (new LogFormatter(pattern));
+    if (new_fmt->isError()) { // check
+        std::cout << "AsyncLogAppender value=" 
+                  << pattern << " invalid pattern. " 
+                  << std::endl;
+        return;
+    }
+    setFormatter(new_fmt);
+}
+
+std::string AsyncLogAppender::toYamlString() {
+    YAML::Node node = YAML::Load(m_backend->toYamlString());
+    node["async"] = true;
+    node["queue_size"] = m_ring.capacity();
+    node["overflow"] = PolicyToString(m_policy);
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
 /*
  * --------------- Logger ---------------
 */
+static std::atomic<uint64_t> s_logger_id(0);
+
 Logger::Logger(const std::string& LogName)
-: m_logname(LogName), m_level(LogLevel::ALL){
+: m_logname(LogName), m_id(++s_logger_id), m_level(LogLevel::ALL), m_enabled(LogLevel::ALL), 
+  m_appenders(new AppenderList), m_version(0) {
     m_formatter.reset(new LogFormatter());
     
 }
 
+void Logger::setLevel (LogLevel::Level level) {
+    m_level.store(level, std::memory_order_relaxed);
+    updateLevel();
+}
+
+void Logger::updateLevel () {
+    int level = std::min(m_level.load(std::memory_order_relaxed), 
+                         (int)SltFlightRecorder::GetInstance()->getLevel());
+    m_enabled.store(level, std::memory_order_relaxed);
+}
+
 void Logger::addAppender (LogAppender::ptr appender){
     MutexType::Lock lock(m_mutex);
     if (!appender->getFormatter()){
         // No formatter
         appender->setFormatter(m_formatter);
     }
-    m_appenders.push_back(appender);
+    std::shared_ptr<AppenderList> appenders (new AppenderList(*m_appenders));
+    appenders->push_back(appender);
+    storeAppenders(appenders);
 }
 void Logger::delAppender (LogAppender::ptr appender){
     MutexType::Lock lock(m_mutex);
-    for (auto it = m_appenders.begin();
-              it != m_appenders.end(); ++it){
+    std::shared_ptr<AppenderList> appenders (new AppenderList(*m_appenders));
+    for (auto it = appenders->begin();
+              it != appenders->end(); ++it){
             if (*it == appender) {
-                m_appenders.erase(it);
+                appenders->erase(it);
                 break;
             }
         }
+    storeAppenders(appenders);
 }
-void Logger::clearAppender() {
+void Logger::setAppenders (const AppenderList& appenders) {
     MutexType::Lock lock(m_mutex);
-    m_appenders.clear();    
+    for (auto& i : appenders) {
+        if (!i->getFormatter()) {
+            i->setFormatter(m_formatter);
+        }
+    }
+    storeAppenders(std::make_shared<const AppenderList>(appenders));
 }
-void Logger::log(LogLevel::Level level, LogEvent::ptr event){
+
+void Logger::clearAppender() {
     MutexType::Lock lock(m_mutex);
-    if (level >= m_level){
-        auto p = shared_from_this();
-        if (! m_appenders.empty()) { 
-            for (auto& i : m_appenders){
-                i->log(p, event);
+    storeAppenders(std::make_shared<const AppenderList>());
+}
+
+void Logger::storeAppenders (std::shared_ptr<const AppenderList> appenders) {
+    std::atomic_store(&m_appenders, appenders);
+    m_version.fetch_add(1, std::memory_order_release);
+}
+
+/*
+ * Per thread copies of the appender lists of the last loggers used, in a 
+ * small direct mapped table. A copy is good while the logger's version 
+ * has not moved; taking it is one atomic increment, no lock.
+ */
+struct CachedAppenders {
+    uint64_t logger = 0;    // Logger::m_id, 0 for none
+    uint64_t version = 0;
+    std::shared_ptr<const Logger::AppenderList> appenders;
+};
+
+static const size_t s_cached_appenders = 8;
+static thread_local CachedAppenders t_appenders[s_cached_appenders];
+
+std::shared_ptr<const Logger::AppenderList> Logger::loadAppenders () const {
+    CachedAppenders& cached = t_appenders[m_id % s_cached_appenders];
+    // read before the list: a list newer than the version is only reloaded once more
+    uint64_t version = m_version.load(std::memory_order_acquire);
+    if (cached.logger != m_id || cached.version != version) {
+        cached.appenders = std::atomic_load(&m_appenders);
+        cached.logger = m_id;
+        cached.version = version;
+    }
+    return cached.appenders;
+}
+void Logger::log(LogLevel::Level level, const LogEvent::ptr& event){
+    FlightRecorder* recorder = SltFlightRecorder::GetInstance();
+    if (recorder->isEnabled(level)) {
+        recorder->record(*event);
+    }
+    if (level >= getLevel() || (event->getSite() && event->getSite()->isForced(m_logname))){
+        // no lock: appenders may block in I/O
+        std::shared_ptr<const AppenderList> appenders = loadAppenders();
+        if (! appenders->empty()) {
+            // format once per formatter
+            auto p = shared_from_this();
+            FormattedEvent formatted;
+            for (auto& i : *appenders){
+                if (LogFormatter::ptr formatter = i->getWriteFormatter()) {
+                    i->write(formatted.get(formatter, p, event));
+                }
+                else {
+                    i->log(p, event);
+                }
             }
         }
         else {
@@ -525,12 +1515,23 @@ void Logger::setFormatter (const std::string& pattern) {
     setFormatter(new_fmt);
 }
 
+std::shared_ptr<BinLogSink> Logger::getBinarySink () {
+    return std::atomic_load(&m_binSink);
+}
+
+void Logger::setBinarySink (std::shared_ptr<BinLogSink> sink) {
+    std::atomic_store(&m_binSink, sink);
+}
+
 std::string Logger::toYamlString() {
     MutexType::Lock lock(m_mutex);
     YAML::Node node;
     node["name"] = m_logname;
-    node["level"] = LogLevel::ToString(m_level);
-    for (auto& i : m_appenders) {
+    node["level"] = LogLevel::ToString(getLevel());
+    if (auto sink = getBinarySink()) {
+        node["binary"] = sink->getFilename();
+    }
+    for (auto& i : *getAppenders()) {
         node["appender"].push_back(YAML::Load(i->toYamlString()));
     }
     std::stringstream ss;
@@ -541,40 +1542,286 @@ std::string Logger::toYamlString() {
 /*
  * --------------- LoggerManager ---------------
 */
+LoggerManager::Table::Table (size_t capacity)
+: mask(capacity - 1), slots(new std::atomic<Node*>[capacity]) {
+    for (size_t i = 0; i < capacity; ++i) {
+        slots[i].store(nullptr, std::memory_order_relaxed);
+    }
+}
+
 LoggerManager::LoggerManager (){
+    m_tables.emplace_back(new Table(64));
+    m_table.store(m_tables.back().get(), std::memory_order_release);
     m_root.reset(new Logger);
     m_root->addAppender(LogAppender::ptr(new StdoutLogAppender));
     init();
 }
 
+std::atomic<LoggerManager::Node*>& LoggerManager::Probe (const Table* table, const std::string& name, size_t hash) {
+    // linear probing, the table is never more than half full
+    for (size_t i = hash & table->mask; ; i = (i + 1) & table->mask) {
+        std::atomic<Node*>& slot = table->slots[i];
+        Node* node = slot.load(std::memory_order_acquire);
+        if (!node || (node->hash == hash && node->name == name)) {
+            return slot;
+        }
+    }
+}
+
+void LoggerManager::insert (const std::string& name, std::shared_ptr<Logger> logger) {
+    size_t hash = std::hash<std::string>()(name);
+    Table* table = m_table.load(std::memory_order_relaxed);
+    std::unique_ptr<Node> node(new Node{name, hash, logger});
+    std::atomic<Node*>& slot = Probe(table, name, hash);
+    if (slot.load(std::memory_order_relaxed)) {
+        // replace, readers see the old node or the new one
+        slot.store(node.get(), std::memory_order_release);
+        m_nodes.push_back(std::move(node));
+        return;
+    }
+    if ((table->size + 1) * 2 > table->mask + 1) {
+        // grow: fill a new table, then publish it
+        Table* bigger = new Table((table->mask + 1) * 2);
+        m_tables.emplace_back(bigger);
+        for (size_t i = 0; i <= table->mask; ++i) {
+            Node* old = table->slots[i].load(std::memory_order_relaxed);
+            if (old) {
+                Probe(bigger, old->name, old->hash).store(old, std::memory_order_relaxed);
+            }
+        }
+        bigger->size = table->size;
+        Probe(bigger, name, hash).store(node.get(), std::memory_order_relaxed);
+        ++bigger->size;
+        m_table.store(bigger, std::memory_order_release);
+    }
+    else {
+        slot.store(node.get(), std::memory_order_release);
+        ++table->size;
+    }
+    m_nodes.push_back(std::move(node));
+}
+
+void LoggerManager::updateLevels () {
+    MutexType::Lock lock(m_mutex);
+    m_root->updateLevel();
+    Table* table = m_table.load(std::memory_order_relaxed);
+    for (size_t i = 0; i <= table->mask; ++i) {
+        if (Node* n = table->slots[i].load(std::memory_order_relaxed)) {
+            n->logger->updateLevel();
+        }
+    }
+}
+
 void LoggerManager::addLogger (const std::string& name, std::shared_ptr<Logger> logger){
     MutexType::Lock lock(m_mutex);
-    if (getLogger(name) != m_root) {
+    size_t hash = std::hash<std::string>()(name);
+    if (Probe(m_table.load(std::memory_order_relaxed), name, hash).load(std::memory_order_relaxed)) {
         std::cout << "Logger exists. " << std::endl;
     }
-    m_loggers[name] = logger;
+    insert(name, logger);
 }
 
 std::shared_ptr<Logger> LoggerManager::getLogger(const std::string& name) {
+    size_t hash = std::hash<std::string>()(name);
+    // lock free
+    Node* node = Probe(m_table.load(std::memory_order_acquire), name, hash).load(std::memory_order_acquire);
+    if (SYLAR_LIKELY(node != nullptr)) {
+        return node->logger;
+    }
     MutexType::Lock lock(m_mutex);
-    auto it = m_loggers.find(name);
-    if (it != m_loggers.end()) {
-        return it->second;
+    // another thread may have created it
+    node = Probe(m_table.load(std::memory_order_relaxed), name, hash).load(std::memory_order_relaxed);
+    if (node) {
+        return node->logger;
     }
     // create new logger
     std::shared_ptr<Logger> logger (new Logger (name));
-    m_loggers[name] = logger;
+    insert(name, logger);
     return logger;
 }
 
+/*
+ * --------------- LogSiteRegistry ---------------
+ */
+bool LogSiteRule::match (const char* site_file, int32_t line, const char* func) const {
+    if (file.empty() && function.empty()) {
+        return false;
+    }
+    if (!file.empty()) {
+        size_t len = strlen(site_file);
+        if (len < file.size() 
+                || file.compare(0, std::string::npos, site_file + len - file.size()) != 0
+                || (len > file.size() && site_file[len - file.size() - 1] != '/')) {
+            return false;
+        }
+    }
+    if (line_begin && (line < line_begin || line > line_end)) {
+        return false;
+    }
+    if (!function.empty() && (!func || function != func)) {
+        return false;
+    }
+    return true;
+}
+
+void LogSiteRegistry::apply (LogSite* site) {
+    std::vector<std::string> loggers;
+    for (auto& rule : m_rules) {
+        if (!rule.match(site->m_file, site->m_line, site->m_func)) {
+            continue;
+        }
+        if (rule.logger.empty()) {
+            site->m_state.store(LogSite::STATE_ON, std::memory_order_release);
+            return;
+        }
+        loggers.push_back(rule.logger);
+    }
+    if (loggers.empty()) {
+        site->m_state.store(LogSite::STATE_OFF, std::memory_order_release);
+        return;
+    }
+    // the list first, a reader seeing STATE_SOME without it does not force
+    const std::vector<std::string>* list = site->m_loggers.load(std::memory_order_relaxed);
+    if (!list || *list != loggers) {
+        m_loggerLists.emplace_back(new std::vector<std::string>(std::move(loggers)));
+        site->m_loggers.store(m_loggerLists.back().get(), std::memory_order_release);
+    }
+    site->m_state.store(LogSite::STATE_SOME, std::memory_order_release);
+}
+
+void LogSiteRegistry::add (LogSite* site, const std::string& logger, const char* func) {
+    MutexType::Lock lock(m_mutex);
+    if (site->m_state.load() != LogSite::STATE_NEW) {
+        // registered by another thread
+        return;
+    }
+    site->m_func = func;
+    Entry entry = { site, logger };
+    m_sites.push_back(entry);
+    apply(site);
+}
+
+void LogSiteRegistry::setRules (const std::vector<LogSiteRule>& rules) {
+    MutexType::Lock lock(m_mutex);
+    m_rules = rules;
+    for (auto& entry : m_sites) {
+        apply(entry.site);
+    }
+}
+
+std::string LogSiteRegistry::toYamlString () {
+    MutexType::Lock lock(m_mutex);
+    YAML::Node node;
+    for (auto& entry : m_sites) {
+        YAML::Node n;
+        n["file"] = entry.site->m_file;
+        n["line"] = entry.site->m_line;
+        n["function"] = entry.site->m_func ? entry.site->m_func : "";
+        n["logger"] = entry.logger;
+        int state = entry.site->m_state.load();
+        n["forced"] = state == LogSite::STATE_ON;
+        if (state == LogSite::STATE_SOME) {
+            for (auto& i : *entry.site->m_loggers.load()) {
+                n["forced_loggers"].push_back(i);
+            }
+        }
+        node.push_back(n);
+    }
+    std::stringstream ss;
+    ss << node;
+    return ss.str();
+}
+
+template<>
+class FromNode<LogSiteRule> {
+public:
+    LogSiteRule operator() (const YAML::Node& node) const {
+        LogSiteRule rule;
+        if (node["file"].IsDefined()) {
+            rule.file = node["file"].as<std::string>();
+        }
+        if (node["line"].IsDefined()) {
+            rule.line_begin = rule.line_end = node["line"].as<int32_t>();
+        }
+        if (node["lines"].IsDefined()) {
+            // "10-40"
+            std::string lines = node["lines"].as<std::string>();
+            rule.line_begin = atoi(lines.c_str());
+            size_t pos = lines.find('-');
+            rule.line_end = pos == std::string::npos ? rule.line_begin : atoi(lines.c_str() + pos + 1);
+        }
+        if (node["function"].IsDefined()) {
+            rule.function = node["function"].as<std::string>();
+        }
+        if (node["logger"].IsDefined()) {
+            rule.logger = node["logger"].as<std::string>();
+        }
+        if (rule.file.empty() && rule.function.empty()) {
+            std::cout << "Log config error: log_sites rule needs a file or a function, " 
+                      << node << std::endl;
+        }
+        return rule;
+    }
+};
+
+template<>
+class ToNode<LogSiteRule> {
+public:
+    YAML::Node operator() (const LogSiteRule& rule) {
+        YAML::Node node;
+        if (!rule.file.empty()) {
+            node["file"] = rule.file;
+        }
+        if (rule.line_begin) {
+            node["lines"] = std::to_string(rule.line_begin) + "-" + std::to_string(rule.line_end);
+        }
+        if (!rule.function.empty()) {
+            node["function"] = rule.function;
+        }
+        if (!rule.logger.empty()) {
+            node["logger"] = rule.logger;
+        }
+        return node;
+    }
+};
+
+sylar::ConfigVar<std::vector<LogSiteRule> >::ptr g_log_sites = 
+      sylar::Config::Lookup("log_sites", std::vector<LogSiteRule> (), "log statements enabled at any level");
+
+struct LogSiteIniter {
+    LogSiteIniter () {
+        g_log_sites->addListener([](const std::vector<LogSiteRule>& old_value, 
+                                    const std::vector<LogSiteRule>& new_value) {
+            SltLogSiteRegistry::GetInstance()->setRules(new_value);
+        });
+    }
+};
+
+static LogSiteIniter __log_site_init;
+
 struct AppenderDefinition {
     int type = 0;
     std::string pattern;
+    int style = LogFormatter::STYLE_TEXT;
     std::string file;
+    // FileLogAppender
+    LogFile::Options file_options;
+    // MmapFileLogAppender
+    MmapLogFile::Options mmap_options;
+    // AsyncLogAppender
+    bool async = false;
+    uint32_t queue_size = 8192;
+    int overflow = AsyncLogAppender::BLOCK;
     bool operator== (const AppenderDefinition& def) const {
         return type == def.type &&
                pattern == def.pattern && 
-               file == def.file;
+               style == def.style &&
+               file == def.file &&
+               file_options == def.file_options &&
+               mmap_options == def.mmap_options &&
+               async == def.async && 
+               queue_size == def.queue_size && 
+               overflow == def.overflow;
     }
 };
 
@@ -582,11 +1829,14 @@ struct LogDefinition {
     std::string name;
     LogLevel::Level level = LogLevel::OFF;
     std::string pattern;
+    // file of the BinLogSink
+    std::string binary;
     std::vector<AppenderDefinition> appenders;
     bool operator== (const LogDefinition& logdef) const {
         return name == logdef.name &&
                level == logdef.level && 
                pattern == logdef.pattern && 
+               binary == logdef.binary && 
                appenders == logdef.appenders;
     }
     bool operator< (const LogDefinition& logdef) const {
@@ -595,10 +1845,9 @@ struct LogDefinition {
 };
 
 template<>
-class LexicalCast<std::string, LogDefinition> {
+class FromNode<LogDefinition> {
 public:
-    LogDefinition operator() (const std::string& string) const {
-        YAML::Node node = YAML::Load(string);
+    LogDefinition operator() (const YAML::Node& node) const {
         LogDefinition def;
         
         // warining if name is not found
@@ -610,6 +1859,9 @@ public:
         
         def.name = node["name"].as<std::string>();
         def.level = LogLevel::FromString(node["level"].IsDefined() ? node["level"].as<std::string>() : "");
+        if (node["binary"].IsDefined()) {
+            def.binary = node["binary"].as<std::string>();
+        }
         if (node["appender"].IsDefined()){
             // Appender 
             for (size_t i = 0; i < node["appender"].size(); ++i) {
@@ -629,10 +1881,54 @@ public:
                         continue;
                     }
                     apDefine.file = item["file"].as<std::string>();
+                    LogFile::Options& options = apDefine.file_options;
+                    if (item["buffer_size"].IsDefined()) {
+                        options.buffer_size = item["buffer_size"].as<size_t>();
+                    }
+                    if (item["flush_interval"].IsDefined()) {
+                        options.flush_interval = item["flush_interval"].as<uint32_t>();
+                    }
+                    if (item["sync"].IsDefined()) {
+                        options.sync = LogFile::SyncFromString(item["sync"].as<std::string>());
+                    }
+                    if (item["sync_interval"].IsDefined()) {
+                        options.sync_interval = item["sync_interval"].as<uint32_t>();
+                    }
+                    if (item["sync_bytes"].IsDefined()) {
+                        options.sync_bytes = item["sync_bytes"].as<uint64_t>();
+                    }
+                    // rotation
+                    if (item["max_size"].IsDefined()) {
+                        options.max_size = LogFile::SizeFromString(item["max_size"].as<std::string>());
+                    }
+                    if (item["rotate"].IsDefined()) {
+                        options.rotate_interval = LogFile::IntervalFromString(item["rotate"].as<std::string>());
+                    }
+                    if (item["max_files"].IsDefined()) {
+                        options.max_files = item["max_files"].as<uint32_t>();
+                    }
+                    if (item["compress"].IsDefined()) {
+                        options.compress = item["compress"].as<bool>();
+                    }
                 }
                 else if (type == "StdoutLogAppender") {
                     apDefine.type = 2;
                 }
+                else if (type == "MmapFileLogAppender") {
+                    apDefine.type = 3;
+                    if (!item["file"].IsDefined()) {
+                        std::cout << "Log config error: mmapfileappender file is not defined. " << std::endl;
+                        continue;
+                    }
+                    apDefine.file = item["file"].as<std::string>();
+                    MmapLogFile::Options& options = apDefine.mmap_options;
+                    if (item["chunk_size"].IsDefined()) {
+                        options.chunk_size = LogFile::SizeFromString(item["chunk_size"].as<std::string>());
+                    }
+                    if (item["flush_interval"].IsDefined()) {
+                        options.flush_interval = item["flush_interval"].as<uint32_t>();
+                    }
+                }
                 else {
                     std::cout << "Log config error: appender type is invalid. " << std::endl;
                     continue;
@@ -641,6 +1937,20 @@ public:
                 if (item["pattern"].IsDefined()) {
                     apDefine.pattern = item["pattern"].as<std::string>();
                 }
+                // text, json or logfmt
+                if (item["format"].IsDefined()) {
+                    apDefine.style = LogFormatter::StyleFromString(item["format"].as<std::string>());
+                }
+                // async
+                if (item["async"].IsDefined()) {
+                    apDefine.async = item["async"].as<bool>();
+                }
+                if (item["queue_size"].IsDefined()) {
+                    apDefine.queue_size = item["queue_size"].as<uint32_t>();
+                }
+                if (item["overflow"].IsDefined()) {
+                    apDefine.overflow = AsyncLogAppender::PolicyFromString(item["overflow"].as<std::string>());
+                }
                 def.appenders.push_back(apDefine);
             }
         }
@@ -651,21 +1961,39 @@ public:
 
 
 template<>
-class LexicalCast<LogDefinition, std::string> {
+class ToNode<LogDefinition> {
 public:
-    std::string operator() (const LogDefinition& def) {
+    YAML::Node operator() (const LogDefinition& def) {
         YAML::Node node;
         node["name"] = def.name;
         node["level"] = LogLevel::ToString(def.level);
+        if (!def.binary.empty()) {
+            node["binary"] = def.binary;
+        }
         for (auto& ap: def.appenders) {
             YAML::Node apNode;
             if (ap.type == 1){
                 // FileLogAppender
                 apNode["type"] = "FileLogAppender";
                 apNode["file"] = ap.file;
+                apNode["buffer_size"] = ap.file_options.buffer_size;
+                apNode["flush_interval"] = ap.file_options.flush_interval;
+                apNode["sync"] = LogFile::SyncToString(ap.file_options.sync);
+                apNode["sync_interval"] = ap.file_options.sync_interval;
+                apNode["sync_bytes"] = ap.file_options.sync_bytes;
+                apNode["max_size"] = ap.file_options.max_size;
+                apNode["rotate"] = LogFile::IntervalToString(ap.file_options.rotate_interval);
+                apNode["max_files"] = ap.file_options.max_files;
+                apNode["compress"] = ap.file_options.compress;
             }else if (ap.type == 2) {
                 // StdoutAppender
                 apNode["type"] = "StdoutAppender";
+            }else if (ap.type == 3) {
+                // MmapFileLogAppender
+                apNode["type"] = "MmapFileLogAppender";
+                apNode["file"] = ap.file;
+                apNode["chunk_size"] = ap.mmap_options.chunk_size;
+                apNode["flush_interval"] = ap.mmap_options.flush_interval;
             }else{
                 std::cout << "Cast Error: invalid type in appender" << std::endl;
             }
@@ -676,11 +2004,17 @@ public:
             else {
                 std::cout << "appender pattern is empty. " << std::endl;
             }
+            if (ap.style != LogFormatter::STYLE_TEXT) {
+                apNode["format"] = LogFormatter::StyleToString((LogFormatter::Style)ap.style);
+            }
+            if (ap.async) {
+                apNode["async"] = true;
+                apNode["queue_size"] = ap.queue_size;
+                apNode["overflow"] = AsyncLogAppender::PolicyToString((AsyncLogAppender::OverflowPolicy)ap.overflow);
+            }
             node["appenders"].push_back(apNode);
         }
-        std::stringstream ss;
-        ss << node;
-        return ss.str();
+        return node;
     }
 };
 
@@ -688,73 +2022,166 @@ public:
 sylar::ConfigVar<std::set<LogDefinition> >::ptr g_log_defines = 
       sylar::Config::Lookup("logs", std::set<LogDefinition> (), "logs config");
 
+/*
+ * Applies the "logs" config. Appenders are built from their definitions
+ * before the old ones are dropped; a definition which did not change keeps
+ * its appender, so its file stays open and its async queue keeps going.
+ * Each logger gets its new list with one store, no event finds it empty.
+ */
 struct LogIniter {
+    // the appenders built for each logger, with their definitions
+    typedef std::vector<std::pair<AppenderDefinition, LogAppender::ptr> > BuiltAppenders;
+
     LogIniter () {
         // add callback function to config
-        auto key = g_log_defines->addListener([](const std::set<LogDefinition>& old_value, 
-                                                 const std::set<LogDefinition>& new_value) {
+        g_log_defines->addListener([](const std::set<LogDefinition>& old_value, 
+                                      const std::set<LogDefinition>& new_value) {
             SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "on logger changed";
-            // operations
-            for (auto& i : new_value) {
-                auto it = old_value.find(i);
-                std::shared_ptr<Logger> logger;
-                if (it == old_value.end()) {
-                    // add new logger
-                    logger = SYLAR_LOG_NAME(i.name);
-                    }
-                else {
-                    if (!(i == *it)){
-                        // modify
-                        logger = SYLAR_LOG_NAME(i.name);
-                    }
-                    else{
-                        continue;
-                    }
+            OnChanged(old_value, new_value);
+        });
+    }
+
+    static std::map<std::string, BuiltAppenders>& Built () {
+        static std::map<std::string, BuiltAppenders> s_built;
+        return s_built;
+    }
+
+    // the LogFile of a FileLogAppender, async or not
+    static LogFile::ptr FileOf (LogAppender::ptr ap) {
+        if (AsyncLogAppender::ptr async = std::dynamic_pointer_cast<AsyncLogAppender>(ap)) {
+            ap = async->getBackend();
+        }
+        FileLogAppender::ptr file = std::dynamic_pointer_cast<FileLogAppender>(ap);
+        return file ? file->getFile() : nullptr;
+    }
+
+    static LogAppender::ptr Build (const AppenderDefinition& a, 
+                                   std::map<std::pair<std::string, int>, LogFormatter::ptr>& formatters,
+                                   const LogFile::ptr& previous) {
+        LogAppender::ptr ap;
+        if (a.type == 1) {
+            // FileLogAppender, shares the open LogFile of the old appender;
+            // its options change only if previous is that file
+            ap.reset(new FileLogAppender(a.file, a.file_options, previous));
+        } 
+        else if (a.type == 2) {
+            // StdoutLogAppender
+            ap.reset(new StdoutLogAppender);
+        }
+        else if (a.type == 3) {
+            // MmapFileLogAppender
+            ap.reset(new MmapFileLogAppender(a.file, a.mmap_options));
+        }
+        else {
+            std::cout << "LogIniter: error type=" << a.type << std::endl;
+            return nullptr;
+        }
+        // set formatter (appender), one object per pattern and style
+        // so Logger::log formats once for all of them; 
+        // without a pattern it takes the logger's
+        if (a.style != LogFormatter::STYLE_TEXT || !a.pattern.empty()) {
+            LogFormatter::ptr& fmt = formatters[std::make_pair(a.pattern, a.style)];
+            if (!fmt) {
+                fmt.reset(new LogFormatter(a.pattern, (LogFormatter::Style)a.style));
+            }
+            if (fmt->isError()) {
+                std::cout << "LogIniter: invalid pattern " << a.pattern << std::endl;
+            }
+            else {
+                ap->setFormatter(fmt);
+            }
+        }
+        if (a.async) {
+            ap.reset(new AsyncLogAppender(ap, a.queue_size, 
+                        (AsyncLogAppender::OverflowPolicy)a.overflow));
+        }
+        return ap;
+    }
+
+    static void OnChanged (const std::set<LogDefinition>& old_value, 
+                           const std::set<LogDefinition>& new_value) {
+        std::map<std::string, BuiltAppenders>& built = Built();
+        // new appenders share the formatters of the current ones
+        std::map<std::pair<std::string, int>, LogFormatter::ptr> formatters;
+        for (auto& i : built) {
+            for (auto& b : i.second) {
+                if (b.first.style != LogFormatter::STYLE_TEXT || !b.first.pattern.empty()) {
+                    formatters.emplace(std::make_pair(b.first.pattern, b.first.style), 
+                                       b.second->getFormatter());
                 }
-                // set level
-                logger->setLevel(i.level);
-                // set formatter (logger)
-                if (!i.pattern.empty()) {
-                    logger->setFormatter(i.pattern);
+            }
+        }
+        // operations
+        for (auto& i : new_value) {
+            auto it = old_value.find(i);
+            if (it != old_value.end() && i == *it) {
+                continue;
+            }
+            // add new logger or modify
+            std::shared_ptr<Logger> logger = SYLAR_LOG_NAME(i.name);
+            // set level
+            logger->setLevel(i.level);
+            // set formatter (logger)
+            if (!i.pattern.empty()) {
+                logger->setFormatter(i.pattern);
+            }
+            // binary sink
+            if (i.binary.empty()) {
+                logger->setBinarySink(nullptr);
+            }
+            else if (it == old_value.end() || i.binary != it->binary) {
+                logger->setBinarySink(BinLogSink::ptr(new BinLogSink(i.binary, i.name)));
+            }
+            // appenders without a pattern use the logger's formatter,
+            // they are only kept while it stays the same
+            bool same_pattern = it != old_value.end() && it->pattern == i.pattern;
+            BuiltAppenders old_built;
+            old_built.swap(built[i.name]);
+            BuiltAppenders new_built;
+            Logger::AppenderList appenders;
+            for (auto& a : i.appenders) {
+                LogAppender::ptr ap;
+                for (auto& b : old_built) {
+                    if (b.second && b.first == a && 
+                            (same_pattern || a.style != LogFormatter::STYLE_TEXT || !a.pattern.empty())) {
+                        // ---------- keep ----------
+                        ap.swap(b.second);
+                        break;
+                    }
                 }
-                // clear appenders
-                logger->clearAppender();
-                // ---------- add ---------- 
-                for (auto& a : i.appenders) {
-                    LogAppender::ptr ap;
-                    if (a.type == 1) {
-                        // FileLogAppender
-                        ap.reset(new FileLogAppender(a.file));
-                        // set formatter (appender)
-                        if (!a.pattern.empty()) {
-                            ap->setFormatter(a.pattern);
+                if (!ap) {
+                    // ---------- add ---------- 
+                    // replacing an appender of this logger on the same file 
+                    // may change the file's options
+                    LogFile::ptr previous;
+                    for (auto& b : old_built) {
+                        if (b.second && a.type == 1 && b.first.type == 1 && b.first.file == a.file) {
+                            previous = FileOf(b.second);
+                            break;
                         }
-                    } 
-                    else if (a.type == 2) {
-                        // StdoutLogAppender
-                        ap.reset(new StdoutLogAppender);
                     }
-                    // set formatter (appender)
-                    if (!a.pattern.empty()) {
-                        ap->setFormatter(a.pattern);
-                    }
-                    else {
-                        std::cout << "LogIniter: error type=" << a.type << std::endl;
-                    }
-                    logger->addAppender(ap);
+                    ap = Build(a, formatters, previous);
                 }
-            
-            for (auto& i : old_value) {
-                auto it = new_value.find(i);
-                if (it == new_value.end()) {
-                    // ---------- delete ---------- 
-                    auto logger = SYLAR_LOG_NAME(i.name);
-                    logger->setLevel(LogLevel::OFF);
-                    logger->clearAppender();
+                if (ap) {
+                    new_built.push_back(std::make_pair(a, ap));
+                    appenders.push_back(ap);
                 }
             }
+            logger->setAppenders(appenders);
+            built[i.name].swap(new_built);
+            // appenders left in old_built are released here, after the swap
+        }
+        for (auto& i : old_value) {
+            auto it = new_value.find(i);
+            if (it == new_value.end()) {
+                // ---------- delete ---------- 
+                auto logger = SYLAR_LOG_NAME(i.name);
+                logger->setLevel(LogLevel::OFF);
+                logger->setBinarySink(nullptr);
+                logger->clearAppender();
+                built.erase(i.name);
+            }
         }
-        });
     }
 };
 
@@ -765,9 +2192,18 @@ void LoggerManager::init() {
 }
 
 std::string LoggerManager::toYamlString() {
-    MutexType::Lock lock(m_mutex);
+    std::map<std::string, std::shared_ptr<Logger> > loggers;
+    {
+        MutexType::Lock lock(m_mutex);
+        Table* table = m_table.load(std::memory_order_relaxed);
+        for (size_t i = 0; i <= table->mask; ++i) {
+            if (Node* n = table->slots[i].load(std::memory_order_relaxed)) {
+                loggers[n->name] = n->logger;
+            }
+        }
+    }
     YAML::Node node;
-    for (auto & i : m_loggers) {
+    for (auto & i : loggers) {
         node.push_back(YAML::Load(i.second->toYamlString()));
     }
     std::stringstream ss;
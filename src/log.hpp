@@ -14,19 +14,43 @@
 #include <list>
 #include <map>
 #include <vector>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <utility>
 #include <functional>
+#include <atomic>
+#include <type_traits>
 
+#include "macro.h"
 #include "utils.hpp"
 #include "singleton.hpp"
 #include "threads.hpp"
+#include "ringbuffer.hpp"
+#include "logfile.hpp"
+
+/*
+ * Statements below SYLAR_LOG_MIN_LEVEL (a LogLevel::Level value, set with
+ * -DSYLAR_LOG_MIN_LEVEL=2) are removed at compile time, the others check
+ * the logger's level with one relaxed atomic load.
+ * Every statement also owns a static LogSite, so the "log_sites" config 
+ * can switch single statements on, see LogSiteRegistry.
+ */
+#ifndef SYLAR_LOG_MIN_LEVEL
+#define SYLAR_LOG_MIN_LEVEL 0
+#endif
+
+#define SYLAR_LOG_SITE()\
+    ([]() -> sylar::LogSite* { static sylar::LogSite site(__FILE__, __LINE__); return &site; }())
+
+// the statement's LogSite if it logs, nullptr otherwise
+#define SYLAR_LOG_ENABLED(logger, level)\
+    ((level) >= SYLAR_LOG_MIN_LEVEL ? SYLAR_LOG_SITE()->check(logger, level, __func__) : nullptr)
 
 #define SYLAR_LOG_LEVEL(logger, level)\
-    if (logger->getLevel() <= level)\
-        sylar::LogEventWrap (sylar::LogEvent::ptr(new sylar::LogEvent (logger, level, __FILE__, __LINE__, 0, sylar::GetThreadID(), sylar::GetFiberID(), time(0)))).getSS()
+    if (sylar::LogSite* sylar_log_site = SYLAR_LOG_ENABLED(logger, level))\
+        sylar::LogEventWrap (sylar::LogEvent::Acquire(logger, level, __FILE__, __LINE__, sylar::GetThreadID(), sylar::GetFiberID(), 0, sylar_log_site)).getSS()
 
 #define SYLAR_LOG_ALL(logger)    SYLAR_LOG_LEVEL(logger, sylar::LogLevel::ALL)
 #define SYLAR_LOG_DEBUG(logger)  SYLAR_LOG_LEVEL(logger, sylar::LogLevel::DEBUG)
@@ -36,8 +60,8 @@
 #define SYLAR_LOG_OFF(logger)    SYLAR_LOG_LEVEL(logger, sylar::LogLevel::OFF)
 
 #define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...)\
-    if (logger->getLevel() <= level)\
-        sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent (logger, level, __FILE__, __LINE__, 0, sylar::GetThreadID(), sylar::GetFiberID(), time(0)))).getEvent()->format(fmt, __VA_ARGS__)
+    if (sylar::LogSite* sylar_log_site = SYLAR_LOG_ENABLED(logger, level))\
+        sylar::LogEventWrap(sylar::LogEvent::Acquire(logger, level, __FILE__, __LINE__, sylar::GetThreadID(), sylar::GetFiberID(), 0, sylar_log_site)).getEvent()->format(fmt, __VA_ARGS__)
 
 #define SYLAR_LOG_FMT_ALL(logger, fmt, ...)   SYLAR_LOG_FMT_LEVEL(logger, LogLevel::ALL, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, LogLevel::DEBUG, fmt, __VA_ARGS__)
@@ -46,12 +70,61 @@
 #define SYLAR_LOG_FMT_ERROR(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, LogLevel::ERROR, fmt, __VA_ARGS__)
 #define SYLAR_LOG_FMT_OFF(logger, fmt, ...)   SYLAR_LOG_FMT_LEVEL(logger, LogLevel::OFF, fmt, __VA_ARGS__)
 
+/*
+ * Throttled statements, checked before any LogEvent is made:
+ *   SYLAR_LOG_EVERY_N      the 1st, (n+1)th, (2n+1)th... call
+ *   SYLAR_LOG_EVERY_MS     at most one message every ms milliseconds
+ *   SYLAR_LOG_RATE_LIMITED per_second messages on average, bursts of burst
+ * The first message after suppressed ones starts with 
+ * "[suppressed N messages] ".
+ */
+#define SYLAR_LOG_THROTTLE()\
+    ([]() -> sylar::LogThrottle* { static sylar::LogThrottle throttle; return &throttle; }())
+
+#define SYLAR_LOG_THROTTLED(logger, level, check)\
+    if (sylar::LogThrottle::Result sylar_log_pass = SYLAR_LOG_THROTTLE()->check)\
+        sylar_log_pass.apply(sylar::LogEventWrap(sylar::LogEvent::Acquire(logger, level, __FILE__, __LINE__, sylar::GetThreadID(), sylar::GetFiberID(), 0, sylar_log_pass.site)).getEvent())
+
+#define SYLAR_LOG_EVERY_N(logger, level, n)\
+    SYLAR_LOG_THROTTLED(logger, level, everyN(SYLAR_LOG_ENABLED(logger, level), n))
+#define SYLAR_LOG_EVERY_MS(logger, level, ms)\
+    SYLAR_LOG_THROTTLED(logger, level, everyMs(SYLAR_LOG_ENABLED(logger, level), ms))
+#define SYLAR_LOG_RATE_LIMITED(logger, level, per_second, burst)\
+    SYLAR_LOG_THROTTLED(logger, level, rateLimited(SYLAR_LOG_ENABLED(logger, level), per_second, burst))
+
+#define SYLAR_LOG_DEBUG_EVERY_N(logger, n)  SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::DEBUG, n)
+#define SYLAR_LOG_INFO_EVERY_N(logger, n)   SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::INFO, n)
+#define SYLAR_LOG_WARN_EVERY_N(logger, n)   SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::WARN, n)
+#define SYLAR_LOG_ERROR_EVERY_N(logger, n)  SYLAR_LOG_EVERY_N(logger, sylar::LogLevel::ERROR, n)
+#define SYLAR_LOG_DEBUG_EVERY_MS(logger, ms) SYLAR_LOG_EVERY_MS(logger, sylar::LogLevel::DEBUG, ms)
+#define SYLAR_LOG_INFO_EVERY_MS(logger, ms)  SYLAR_LOG_EVERY_MS(logger, sylar::LogLevel::INFO, ms)
+#define SYLAR_LOG_WARN_EVERY_MS(logger, ms)  SYLAR_LOG_EVERY_MS(logger, sylar::LogLevel::WARN, ms)
+#define SYLAR_LOG_ERROR_EVERY_MS(logger, ms) SYLAR_LOG_EVERY_MS(logger, sylar::LogLevel::ERROR, ms)
+
+/*
+ * SYLAR_LOG_FMTX_INFO(logger, "user {} took {}ms", name, ms);
+ * fmt has to be a string literal, the number of {} is checked at compile time.
+ */
+#define SYLAR_LOG_FMTX_LEVEL(logger, level, fmt, ...)\
+    if (sylar::LogSite* sylar_log_site = sylar::FmtCheck<sylar::FmtCountArgs(fmt) == decltype(sylar::FmtArgCount(__VA_ARGS__))::value>::value\
+                                         ? SYLAR_LOG_ENABLED(logger, level) : nullptr)\
+        sylar::LogEventWrap(sylar::LogEvent::Acquire(logger, level, __FILE__, __LINE__, sylar::GetThreadID(), sylar::GetFiberID(), 0, sylar_log_site)).getEvent()->formatx(fmt, ##__VA_ARGS__)
+
+#define SYLAR_LOG_FMTX_DEBUG(logger, fmt, ...) SYLAR_LOG_FMTX_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FMTX_INFO(logger, fmt, ...)  SYLAR_LOG_FMTX_LEVEL(logger, sylar::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FMTX_WARN(logger, fmt, ...)  SYLAR_LOG_FMTX_LEVEL(logger, sylar::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FMTX_ERROR(logger, fmt, ...) SYLAR_LOG_FMTX_LEVEL(logger, sylar::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+
 #define SYLAR_LOG_ROOT() sylar::SltLoggerMgr::GetInstance()->getRoot()
 #define SYLAR_LOG_NAME(name) sylar::SltLoggerMgr::GetInstance()->getLogger(name)
+// looked up once per call site, name has to be a constant
+#define SYLAR_LOG_NAME_CACHED(name)\
+    ([]() -> const sylar::Logger::ptr& { static const sylar::Logger::ptr logger = SYLAR_LOG_NAME(name); return logger; }())
 
 namespace sylar{
 
 class Logger;
+class BinLogSink;
 
 class LogLevel{
 public:
@@ -70,6 +143,274 @@ public:
     static LogLevel::Level FromString(const std::string& str);
 };
 
+/*
+ * A log statement. The object is a constant-initialized static inside the
+ * statement, registered in LogSiteRegistry the first time it runs.
+ * A disabled, registered site costs one load and one branch.
+ */
+class LogSite {
+public:
+    enum State {
+        STATE_NEW  = 0, // not registered yet
+        STATE_OFF  = 1, // logs when the logger's level allows it
+        STATE_ON   = 2, // forced on by a log_sites rule, for every logger
+        STATE_SOME = 3  // forced on for the loggers named by log_sites rules
+    };
+    constexpr LogSite (const char* file, int32_t line)
+        : m_file(file), m_line(line), m_func(nullptr), m_state(STATE_NEW), m_loggers(nullptr) {}
+
+    const char* getFile () const { return m_file; }
+    int32_t getLine () const { return m_line; }
+    // whether a log_sites rule forces the statement on for this logger
+    bool isForced (const std::string& logger) const;
+    // return this if the statement logs, nullptr otherwise
+    LogSite* check (const std::shared_ptr<Logger>& logger, LogLevel::Level level, const char* func);
+private:
+    friend class LogSiteRegistry;
+    LogSite (const LogSite&) = delete;
+    LogSite& operator= (const LogSite&) = delete;
+
+    const char* m_file;
+    int32_t m_line;
+    // set on registration
+    const char* m_func;
+    std::atomic<int> m_state;
+    // STATE_SOME: the loggers forced on, owned by LogSiteRegistry
+    std::atomic<const std::vector<std::string>*> m_loggers;
+};
+
+/*
+ * Output buffer of a LogEvent. Short messages stay in the inline array, 
+ * longer ones move to the heap. Unlike std::stringbuf, the bytes written 
+ * can be read in place without copying them out.
+ */
+class LogStreamBuf : public std::streambuf {
+public:
+    LogStreamBuf() { setp(m_inline, m_inline + sizeof(m_inline)); }
+    const char* data() const { return pbase(); }
+    size_t size() const { return pptr() - pbase(); }
+    // drop the content but keep the storage
+    void clear() { setp(pbase(), epptr()); }
+    void append(const char* s, size_t n) {
+        if ((size_t)(epptr() - pptr()) < n) {
+            reserve(n);
+        }
+        memcpy(pptr(), s, n);
+        pbump(n);
+    }
+    // write in place: reserve(n), write at most available() bytes at tail(), commit them
+    void reserve(size_t n);
+    char* tail() { return pptr(); }
+    size_t available() const { return epptr() - pptr(); }
+    void commit(size_t n) { pbump(n); }
+protected:
+    virtual int_type overflow(int_type c) override;
+    virtual std::streamsize xsputn(const char* s, std::streamsize n) override;
+private:
+    char m_inline[256];
+    std::unique_ptr<char[]> m_heap;
+};
+
+/*
+ * Typed key/value fields of a LogEvent, added with LogStream::kv().
+ * Keys and string values are copied into one buffer; the buffer and the
+ * field list keep their capacity when the event is recycled.
+ */
+class LogFields {
+public:
+    enum Type {
+        TYPE_INT    = 0,
+        TYPE_UINT   = 1,
+        TYPE_DOUBLE = 2,
+        TYPE_BOOL   = 3,
+        TYPE_STRING = 4
+    };
+    struct Field {
+        Type type;
+        // key and TYPE_STRING value, offsets in data()
+        uint32_t key;
+        uint32_t key_length;
+        uint32_t str;
+        uint32_t str_length;
+        union {
+            int64_t i;
+            uint64_t u;
+            double d;
+            bool b;
+        };
+    };
+    typedef std::vector<Field>::const_iterator const_iterator;
+
+    void clear () { m_fields.clear(); m_data.clear(); }
+    bool empty () const { return m_fields.empty(); }
+    size_t size () const { return m_fields.size(); }
+    const_iterator begin () const { return m_fields.begin(); }
+    const_iterator end () const { return m_fields.end(); }
+    const char* data () const { return m_data.data(); }
+
+    void add (const char* key, const char* value) { addString(key, value ? value : "(null)", value ? strlen(value) : 6); }
+    void add (const char* key, char* value) { add(key, (const char*)value); }
+    void add (const char* key, const std::string& value) { addString(key, value.data(), value.size()); }
+    void add (const char* key, char value) { addString(key, &value, 1); }
+    void add (const char* key, bool value) { newField(key, TYPE_BOOL).b = value; }
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    add (const char* key, T value) { newField(key, TYPE_INT).i = value; }
+
+    template<class T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+    add (const char* key, T value) { newField(key, TYPE_UINT).u = value; }
+
+    template<class T>
+    typename std::enable_if<std::is_enum<T>::value>::type
+    add (const char* key, T value) { newField(key, TYPE_INT).i = (int64_t)value; }
+
+    template<class T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    add (const char* key, T value) { newField(key, TYPE_DOUBLE).d = value; }
+
+    // anything else through operator<<
+    template<class T>
+    typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value
+                            && !std::is_array<T>::value>::type
+    add (const char* key, const T& value) {
+        std::ostringstream ss;
+        ss << value;
+        add(key, ss.str());
+    }
+private:
+    Field& newField (const char* key, Type type) {
+        m_fields.push_back(Field());
+        Field& field = m_fields.back();
+        field.type = type;
+        field.key = m_data.size();
+        field.key_length = strlen(key);
+        field.str = field.str_length = 0;
+        m_data.append(key, field.key_length);
+        return field;
+    }
+    void addString (const char* key, const char* value, size_t len) {
+        Field& field = newField(key, TYPE_STRING);
+        field.str = m_data.size();
+        field.str_length = len;
+        m_data.append(value, len);
+    }
+
+    std::vector<Field> m_fields;
+    std::string m_data;
+};
+
+/*
+ * The stream of a LogEvent. kv() attaches a typed field to the event:
+ *   SYLAR_LOG_INFO(g_logger).kv("uid", id).kv("path", path) << "login";
+ * Text patterns print fields after the message as key=value, 
+ * the json and logfmt styles of LogFormatter as their own keys.
+ */
+class LogStream : public std::ostream {
+public:
+    LogStream (LogStreamBuf* buf, LogFields* fields) : std::ostream(buf), m_fields(fields) {}
+    template<class T>
+    LogStream& kv (const char* key, const T& value) {
+        m_fields->add(key, value);
+        return *this;
+    }
+private:
+    LogFields* m_fields;
+};
+
+/*
+ * "{}" formatting for SYLAR_LOG_FMTX, written straight into a LogStreamBuf.
+ * "{{" and "}}" are literal braces. Integers, floats (shortest text that
+ * reads back to the same value), strings, chars, bools and pointers are
+ * converted without allocating; other types go through operator<<.
+ */
+// number of {} in a format string, at compile time for literals
+constexpr size_t FmtCountArgs(const char* s) {
+    return *s == '\0' ? 0
+         : (s[0] == '{' && s[1] == '{') || (s[0] == '}' && s[1] == '}') ? FmtCountArgs(s + 2)
+         : (s[0] == '{' && s[1] == '}') ? 1 + FmtCountArgs(s + 2)
+         : FmtCountArgs(s + 1);
+}
+
+// only used in decltype
+template<class... Args>
+std::integral_constant<size_t, sizeof...(Args)> FmtArgCount(const Args&...);
+
+template<bool ok>
+struct FmtCheck {
+    static_assert(ok, "SYLAR_LOG_FMTX: the number of {} does not match the number of arguments");
+    static constexpr bool value = true;
+};
+
+// append fmt up to the next {}, return what follows it, nullptr at the end
+const char* FmtLiteral(LogStreamBuf& buf, const char* fmt);
+void FmtAppendInt(LogStreamBuf& buf, int64_t value);
+void FmtAppendUInt(LogStreamBuf& buf, uint64_t value);
+void FmtAppendHex(LogStreamBuf& buf, uint64_t value);
+// shortest text of value (as a float if single), out needs 32 bytes
+size_t FmtDouble(char* out, double value, bool single = false);
+void FmtAppend(LogStreamBuf& buf, double value);
+void FmtAppend(LogStreamBuf& buf, float value);
+
+inline void FmtAppend(LogStreamBuf& buf, long double value) { FmtAppend(buf, (double)value); }
+inline void FmtAppend(LogStreamBuf& buf, bool value) { 
+    value ? buf.append("true", 4) : buf.append("false", 5); 
+}
+inline void FmtAppend(LogStreamBuf& buf, char value) { buf.append(&value, 1); }
+inline void FmtAppend(LogStreamBuf& buf, const char* str) {
+    if (!str) {
+        str = "(null)";
+    }
+    buf.append(str, strlen(str));
+}
+inline void FmtAppend(LogStreamBuf& buf, char* str) { FmtAppend(buf, (const char*)str); }
+inline void FmtAppend(LogStreamBuf& buf, const std::string& str) { buf.append(str.data(), str.size()); }
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+FmtAppend(LogStreamBuf& buf, T value) { FmtAppendInt(buf, value); }
+
+template<class T>
+typename std::enable_if<std::is_integral<T>::value && !std::is_signed<T>::value>::type
+FmtAppend(LogStreamBuf& buf, T value) { FmtAppendUInt(buf, value); }
+
+template<class T>
+typename std::enable_if<std::is_enum<T>::value>::type
+FmtAppend(LogStreamBuf& buf, T value) { FmtAppendInt(buf, (int64_t)value); }
+
+template<class T>
+void FmtAppend(LogStreamBuf& buf, T* ptr) {
+    buf.append("0x", 2);
+    FmtAppendHex(buf, (uintptr_t)ptr);
+}
+
+template<class T>
+typename std::enable_if<!std::is_arithmetic<T>::value && !std::is_enum<T>::value 
+                        && !std::is_pointer<T>::value && !std::is_array<T>::value>::type
+FmtAppend(LogStreamBuf& buf, const T& value) {
+    std::ostream os(&buf);
+    os << value;
+}
+
+inline void FmtWrite(LogStreamBuf& buf, const char* fmt) {
+    while ((fmt = FmtLiteral(buf, fmt))) {
+        // no argument left
+        buf.append("{}", 2);
+    }
+}
+
+template<class T, class... Args>
+void FmtWrite(LogStreamBuf& buf, const char* fmt, const T& value, const Args&... args) {
+    fmt = FmtLiteral(buf, fmt);
+    if (!fmt) {
+        // more arguments than {}
+        return;
+    }
+    FmtAppend(buf, value);
+    FmtWrite(buf, fmt, args...);
+}
+
 class LogEvent{
 public:
 /*
@@ -80,6 +421,17 @@ public:
  * 2. Log out by its logger ( event.getLogger()->log() )
  */
     typedef std::shared_ptr<LogEvent> ptr;
+    // the logger is borrowed, it has to outlive the event
+    LogEvent (Logger* logger, 
+              LogLevel::Level level,
+              const char* file, 
+              int32_t line, 
+              uint32_t threadID, 
+              uint32_t fiberID, 
+              uint32_t elapse, 
+              uint32_t time,
+              uint32_t usec = 0
+              );
     LogEvent (std::shared_ptr<Logger> logger, 
               LogLevel::Level level,
               const char* file, 
@@ -87,24 +439,70 @@ public:
               uint32_t threadID, 
               uint32_t fiberID, 
               uint32_t elapse, 
-              uint32_t time
+              uint32_t time,
+              uint32_t usec = 0
               );
 
-    std::shared_ptr<Logger> getLogger() const { return m_logger; }
+    /*
+     * Events are recycled through a per-thread free list:
+     * Acquire() reuses a released event (its buffer keeps its capacity), 
+     * Release() takes the event back if nobody else holds it.
+     * Acquire() stamps the event with GetCurrentUS().
+     */
+    static LogEvent::ptr Acquire (const std::shared_ptr<Logger>& logger, 
+                                  LogLevel::Level level,
+                                  const char* file, 
+                                  int32_t line, 
+                                  uint32_t threadID, 
+                                  uint32_t fiberID, 
+                                  uint32_t elapse,
+                                  const LogSite* site = nullptr);
+    static void Release (LogEvent::ptr& event);
+
+    Logger* getLogger() const { return m_logger; }
     LogLevel::Level getLevel() const { return m_level; }
     const char* getFileName() const { return m_filename; }
     int32_t getLineNumber() const { return m_line; }
     uint32_t getThreadID() const { return m_threadID; }
     uint32_t getFiberID() const { return m_fiberID; }
+    // name of the thread which made the event
+    const char* getThreadName() const { return m_threadName; }
+    size_t getThreadNameSize() const { return m_threadNameSize; }
+    // for an event not made on its thread, e.g. one read back from a file
+    void setThreadName (const std::string& name);
     uint32_t getElapse() const {return m_elapse; }
     uint32_t getTime() const { return m_time; }
-    std::string getContent() const { return m_ss.str(); } 
-    std::stringstream& getSS() { return m_ss; }
+    // microseconds within the second of getTime()
+    uint32_t getUsec() const { return m_usec; }
+    // statement which made the event, nullptr if not made by a macro
+    const LogSite* getSite() const { return m_site; }
+    std::string getContent() const { return std::string(m_buf.data(), m_buf.size()); } 
+    // read the content in place
+    const char* getContentData() const { return m_buf.data(); }
+    size_t getContentSize() const { return m_buf.size(); }
+    LogStream& getSS() { return m_ss; }
+    const LogFields& getFields() const { return m_fields; }
 
     void format(const char* fmt, ...);
     void format(const char* fmt, va_list al);
+    // "{}" placeholders, see FmtWrite
+    template<class... Args>
+    void formatx(const char* fmt, const Args&... args) { FmtWrite(m_buf, fmt, args...); }
 private:
-    std::shared_ptr<Logger> m_logger;
+    LogEvent (const LogEvent&) = delete;
+    LogEvent& operator= (const LogEvent&) = delete;
+    void setThreadName ();
+    void reset (Logger* logger, 
+                LogLevel::Level level,
+                const char* file, 
+                int32_t line, 
+                uint32_t threadID, 
+                uint32_t fiberID, 
+                uint32_t elapse, 
+                uint32_t time,
+                uint32_t usec);
+
+    Logger* m_logger;
     LogLevel::Level m_level;
     const char* m_filename = nullptr;
     int32_t m_line = 0;
@@ -112,26 +510,143 @@ private:
     uint32_t m_fiberID = 0;
     uint32_t m_elapse = 0;
     uint32_t m_time;
-    std::stringstream m_ss;
+    uint32_t m_usec = 0;
+    const LogSite* m_site = nullptr;
+    uint32_t m_threadNameSize = 0;
+    char m_threadName[sizeof(ThreadIdentity::name) + 1];
+    LogStreamBuf m_buf;
+    LogFields m_fields;
+    LogStream m_ss;
+};
+
+/*
+ * Per-statement state of the throttled macros, lock free.
+ * A constant-initialized static like LogSite.
+ */
+class LogThrottle {
+public:
+    struct Result {
+        LogSite* site;
+        // messages dropped since the last one that passed
+        uint64_t suppressed;
+        explicit operator bool () const { return site != nullptr; }
+        // start the message with the suppressed count
+        LogStream& apply (const LogEvent::ptr& event) const {
+            if (suppressed) {
+                event->getSS() << "[suppressed " << suppressed << " messages] ";
+            }
+            return event->getSS();
+        }
+    };
+    constexpr LogThrottle () : m_count(0), m_next(0), m_suppressed(0) {}
+
+    Result everyN (LogSite* site, uint64_t n) {
+        if (!site) {
+            return Result{nullptr, 0};
+        }
+        uint64_t count = m_count.fetch_add(1, std::memory_order_relaxed);
+        if (n > 1 && count % n) {
+            return Result{nullptr, 0};
+        }
+        return Result{site, count && n > 1 ? n - 1 : 0};
+    }
+
+    Result everyMs (LogSite* site, uint64_t ms) {
+        if (!site) {
+            return Result{nullptr, 0};
+        }
+        uint64_t now = GetCurrentMS();
+        uint64_t next = m_next.load(std::memory_order_relaxed);
+        if (now < next || !m_next.compare_exchange_strong(next, now + ms)) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return Result{nullptr, 0};
+        }
+        return Result{site, m_suppressed.exchange(0)};
+    }
+
+    // token bucket kept as one "theoretical arrival time" (GCRA)
+    Result rateLimited (LogSite* site, double per_second, uint32_t burst) {
+        if (!site) {
+            return Result{nullptr, 0};
+        }
+        if (per_second <= 0) {
+            m_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return Result{nullptr, 0};
+        }
+        uint64_t interval = 1000000 / per_second;
+        uint64_t tolerance = interval * (burst ? burst - 1 : 0);
+        uint64_t now = GetCurrentUS();
+        uint64_t tat = m_next.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t start = tat > now ? tat : now;
+            if (start - now > tolerance) {
+                m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                return Result{nullptr, 0};
+            }
+            if (m_next.compare_exchange_weak(tat, start + interval)) {
+                break;
+            }
+        }
+        return Result{site, m_suppressed.exchange(0)};
+    }
+private:
+    LogThrottle (const LogThrottle&) = delete;
+    LogThrottle& operator= (const LogThrottle&) = delete;
+
+    // EVERY_N: calls so far
+    std::atomic<uint64_t> m_count;
+    // EVERY_MS: first ms of the next window, RATE_LIMITED: arrival time in us
+    std::atomic<uint64_t> m_next;
+    std::atomic<uint64_t> m_suppressed;
 };
 
 class LogEventWrap {
 public:
-    LogEventWrap(LogEvent::ptr e);
+    LogEventWrap(LogEvent::ptr&& e);
     ~LogEventWrap();
-    std::stringstream& getSS();
-    LogEvent::ptr getEvent();
+    LogStream& getSS();
+    const LogEvent::ptr& getEvent();
 private:
     LogEvent::ptr m_event;
 };
 
+/*
+ * parse() compiles the pattern twice:
+ * 1. m_ops, a flat array of opcodes run by a switch in format(), 
+ *    literals are kept in one string and referenced by offset
+ * 2. m_items, one FormatItem object per pattern item, 
+ *    used by format(std::ostream&, ...)
+ *
+ * STYLE_JSON and STYLE_LOGFMT write one structured line per event. The
+ * pattern only chooses the keys: %d time, %p level, %t thread, %N thread_name, %F fiber, 
+ * %f file, %l line, %r elapse, %ms msec, %us usec, %m msg, followed by the 
+ * event's kv() fields. Literal text, %T and %n are left out.
+ */
 class LogFormatter {
 public:
     typedef std::shared_ptr<LogFormatter> ptr;
-    LogFormatter(const std::string& pattern = ""); 
+    enum Style {
+        STYLE_TEXT   = 0,
+        STYLE_JSON   = 1, // {"time":"...","level":"INFO",...}
+        STYLE_LOGFMT = 2  // time="..." level=INFO ...
+    };
+    static const char* StyleToString(Style style);
+    // "text", "json" or "logfmt"
+    static Style StyleFromString(const std::string& str);
+
+    LogFormatter(const std::string& pattern = "", Style style = STYLE_TEXT); 
     void parse();
-    std::string format(std::shared_ptr<Logger> logger_ptr, LogEvent::ptr event);
+    std::string format(const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event);
+    // append the formatted event to out
+    void format(std::string& out, const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event);
+    // format into a per-thread buffer, valid until the next call on this thread.
+    // A log call made before the text is used overwrites it, the appenders 
+    // format through a per-depth buffer instead
+    const std::string& formatLocal(const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event);
+    // format through the FormatItem objects
+    std::ostream& format(std::ostream& os, const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event);
     std::string getPattern() const { return m_pattern; }
+    Style getStyle() const { return m_style; }
     void setPattern(const std::string& pattern) {
         m_pattern = pattern;
         parse();
@@ -146,8 +661,52 @@ public:
     };
     bool isError() const { return m_error; }
 
+    // a string value, quoted and escaped as style needs (text quotes like logfmt)
+    static void AppendValue(std::string& out, const char* s, size_t n, Style style);
+    // json escapes for the bytes of out from begin on
+    static void EscapeFrom(std::string& out, size_t begin);
+    // the kv() fields of an event, a separator before the first one unless first
+    static void AppendFields(std::string& out, const LogFields& fields, Style style, bool first);
+
 private:
+    enum OpCode {
+        OP_STRING = 0,
+        OP_MESSAGE,
+        OP_LEVEL,
+        OP_ELAPSE,
+        OP_THREAD_ID,
+        OP_FIBER_ID,
+        OP_DATETIME,
+        OP_FILENAME,
+        OP_LINE,
+        OP_NEWLINE,
+        OP_TAB,
+        OP_MSEC,
+        OP_USEC,
+        OP_THREAD_NAME,
+        OP_FIELDS,          // the kv() fields, offset is 1 if no key comes before
+        // STYLE_JSON and STYLE_LOGFMT
+        OP_MESSAGE_VALUE,   // quoted and escaped as the style needs
+        OP_FILENAME_VALUE,
+        OP_THREAD_NAME_VALUE,
+        OP_DATETIME_VALUE   // escaped, the quotes are literals around it
+    };
+    struct Op {
+        uint32_t code;
+        // literal text (OP_STRING) or time format (OP_DATETIME) in m_literals
+        uint32_t offset;
+        uint32_t length;
+    };
+    void addOp(OpCode code, const std::string& literal = "");
+    // turn m_ops into key/value output for m_style, see logfields.cpp
+    void compileStructured();
+    // the ops only structured output and kv() fields use
+    void formatStructured(std::string& out, const Op& op, const LogEvent::ptr& event);
+
     std::string m_pattern;
+    Style m_style;
+    std::vector<Op> m_ops;
+    std::string m_literals;
     std::vector<FormatItem::ptr> m_items;
     std::shared_ptr<Logger> m_logger_ptr;
     bool m_error = false;
@@ -158,67 +717,141 @@ public:
     typedef std::shared_ptr<LogAppender> ptr;
     typedef SpinLock MutexType; // used Mutex type
     virtual ~LogAppender() {} // free space of derived class
-    virtual void log (std::shared_ptr<Logger> logger_ptr, LogEvent::ptr event) = 0;
+    virtual void log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) = 0;
+    // write a message which is already formatted
+    virtual void write (const std::string& msg) = 0;
+    // push buffered data to its destination
+    virtual void flush () {}
     virtual std::string toYamlString() = 0;
     
     virtual void setFormatter (LogFormatter::ptr formatter);
     virtual void setFormatter (const std::string& pattern) = 0; 
     LogFormatter::ptr getFormatter ();
+    // the formatter whose output log() writes unchanged, nullptr if log() 
+    // does more than that. Logger::log formats an event once for all the 
+    // appenders with the same formatter and calls their write().
+    virtual LogFormatter::ptr getWriteFormatter () { return nullptr; }
 
 protected:
     LogFormatter::ptr m_formatter;
     MutexType m_mutex;
 };
 
-// provide share_from_this() to generate a pointer of this
+/*
+ * provide share_from_this() to generate a pointer of this
+ * The appender list is copy-on-write: add/del/clearAppender build a new list
+ * under m_mutex, publish it with std::atomic_store and bump m_version. 
+ * std::atomic_load on a shared_ptr is not lock-free in libstdc++ (it takes 
+ * a mutex from a small global pool), so log() keeps a per-thread copy of 
+ * the list and only loads it again once m_version moved: in steady state 
+ * a log() call takes no lock. A log() call still holding the old list 
+ * keeps it alive until it returns; a thread's copy keeps it alive until 
+ * the thread logs to this logger again or exits.
+ */
 class Logger : public std::enable_shared_from_this<Logger> {
 public:
     typedef std::shared_ptr<Logger> ptr;
     typedef SpinLock MutexType;
+    typedef std::vector<LogAppender::ptr> AppenderList;
     Logger(const std::string& LogName = "root");
     
     void addAppender (LogAppender::ptr appender);
     void delAppender (LogAppender::ptr appender);
     void clearAppender ();
+    // replace every appender with one store, log() sees the old list or the new one
+    void setAppenders (const AppenderList& appenders);
+    // snapshot of the appenders, locks a libstdc++ pool mutex
+    std::shared_ptr<const AppenderList> getAppenders () const { return std::atomic_load(&m_appenders); }
 
     // Level control
-    LogLevel::Level getLevel () const { return m_level; }
-    void setLevel (LogLevel::Level level) { m_level = level; }
+    LogLevel::Level getLevel () const { return (LogLevel::Level)m_level.load(std::memory_order_relaxed); }
+    void setLevel (LogLevel::Level level);
+    // whether a statement makes an event: at the logger's level, or at the 
+    // FlightRecorder's when that is lower (the event is then only recorded)
+    bool isEnabled (LogLevel::Level level) const { return level >= m_enabled.load(std::memory_order_relaxed); }
+    // take a new FlightRecorder level into account
+    void updateLevel ();
     LogFormatter::ptr getFormatter();
     void setFormatter (const LogFormatter::ptr formatter);
     void setFormatter (const std::string& str);
+    // records of SYLAR_LOG_BIN_* go to the sink, see binlog.hpp
+    std::shared_ptr<BinLogSink> getBinarySink ();
+    void setBinarySink (std::shared_ptr<BinLogSink> sink);
+    const std::string& getName () const { return m_logname; }
 
     // log 
-    void log (LogLevel::Level level, LogEvent::ptr event);
+    void log (LogLevel::Level level, const LogEvent::ptr& event);
 
     // Other log functions
-    void debug (LogEvent::ptr event) { log (LogLevel::DEBUG, event); }
-    void info (LogEvent::ptr event)  { log (LogLevel::INFO, event);  }
-    void warn (LogEvent::ptr event)  { log (LogLevel::WARN, event);  }
-    void error (LogEvent::ptr event) { log (LogLevel::ERROR, event); }
+    void debug (const LogEvent::ptr& event) { log (LogLevel::DEBUG, event); }
+    void info (const LogEvent::ptr& event)  { log (LogLevel::INFO, event);  }
+    void warn (const LogEvent::ptr& event)  { log (LogLevel::WARN, event);  }
+    void error (const LogEvent::ptr& event) { log (LogLevel::ERROR, event); }
     
     std::string toYamlString ();
+private:
+    // the appenders through the calling thread's copy
+    std::shared_ptr<const AppenderList> loadAppenders () const;
+    // publish a new appender list, m_mutex held
+    void storeAppenders (std::shared_ptr<const AppenderList> appenders);
 private:
     std::string m_logname;
-    LogLevel::Level m_level; 
-    std::list<LogAppender::ptr> m_appenders;
+    // unique per logger, keys the per-thread copies of m_appenders
+    const uint64_t m_id;
+    std::atomic<int> m_level; 
+    // the lower of m_level and the FlightRecorder level
+    std::atomic<int> m_enabled;
+    std::shared_ptr<const AppenderList> m_appenders;
+    // bumped after each store of m_appenders
+    std::atomic<uint64_t> m_version;
     LogFormatter::ptr m_formatter;
+    std::shared_ptr<BinLogSink> m_binSink;
+    // serializes the writers of m_appenders, guards m_formatter
     MutexType m_mutex;
     //std::shared_ptr<Logger> m_root; // default logger
 };
 
+/*
+ * Loggers are never removed, so m_loggers is an insert-only open addressing
+ * hash table of atomic node pointers. getLogger() finds an existing logger 
+ * with one acquire load and a probe, without locking. Creating a logger, 
+ * replacing one and growing the table are serialized by m_mutex; a grown 
+ * table is published with one store. Old tables and replaced nodes are only 
+ * freed with the manager, since readers may still be using them.
+ */
 class LoggerManager {
 public:
     typedef SpinLock MutexType;
     LoggerManager ();
     std::shared_ptr<Logger> getLogger(const std::string& name);
     void addLogger (const std::string& name, std::shared_ptr<Logger> logger);
+    // Logger::updateLevel() on every logger
+    void updateLevels ();
     void init();
     std::shared_ptr<Logger> getRoot() const { return m_root; }
     std::string toYamlString();
 
 private:
-    std::map<std::string, std::shared_ptr<Logger> > m_loggers;
+    struct Node {
+        std::string name;
+        size_t hash;
+        std::shared_ptr<Logger> logger;
+    };
+    struct Table {
+        Table (size_t capacity);
+        size_t mask;
+        size_t size = 0;
+        std::unique_ptr<std::atomic<Node*>[]> slots;
+    };
+    // the slot of name in table, it holds nullptr if name is not there
+    static std::atomic<Node*>& Probe (const Table* table, const std::string& name, size_t hash);
+    // add or replace, m_mutex held
+    void insert (const std::string& name, std::shared_ptr<Logger> logger);
+
+    std::atomic<Table*> m_table;
+    // owners of every table and node so far, guarded by m_mutex
+    std::vector<std::unique_ptr<Table> > m_tables;
+    std::vector<std::unique_ptr<Node> > m_nodes;
     std::shared_ptr<Logger> m_root;
     MutexType m_mutex;
 };
@@ -232,28 +865,192 @@ private:
 class StdoutLogAppender : public LogAppender {
 public:
     typedef std::shared_ptr<StdoutLogAppender> ptr;
-    virtual void log (std::shared_ptr<Logger> logger_ptr, LogEvent::ptr event) override;
+    virtual void log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) override;
+    virtual void write (const std::string& msg) override;
+    virtual void flush () override;
     virtual std::string toYamlString() override;
-    virtual void setFormatter (LogFormatter::ptr formatter) override { m_formatter = formatter; }
+    using LogAppender::setFormatter;
     virtual void setFormatter(const std::string& pattern) override;
+    virtual LogFormatter::ptr getWriteFormatter () override { return getFormatter(); }
 private:
 };
 
 class FileLogAppender : public LogAppender {
 public:
-    FileLogAppender (const std::string& filename);
-    virtual void log (std::shared_ptr<Logger> logger_ptr, LogEvent::ptr event) override;
+    typedef std::shared_ptr<FileLogAppender> ptr;
+    // previous: the file of the appender this one replaces, see LogFile::Open
+    FileLogAppender (const std::string& filename, 
+                     const LogFile::Options& options = LogFile::Options(),
+                     const LogFile::ptr& previous = nullptr);
+    virtual void log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) override;
+    virtual void write (const std::string& msg) override;
+    virtual void flush () override;
     virtual std::string toYamlString() override;
-    virtual void setFormatter (LogFormatter::ptr formatter) override { m_formatter = formatter; }
+    using LogAppender::setFormatter;
     virtual void setFormatter(const std::string& pattern) override;
+    virtual LogFormatter::ptr getWriteFormatter () override { return getFormatter(); }
     bool reopen (); // reopen the file, return True if success
+    LogFile::Options getOptions () const { return m_file->getOptions(); }
+    const LogFile::ptr& getFile () const { return m_file; }
+private:
+    std::string m_filename;
+    LogFile::ptr m_file;
+};
+
+// Appends through a memory mapping, see MmapLogFile
+class MmapFileLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<MmapFileLogAppender> ptr;
+    MmapFileLogAppender (const std::string& filename, 
+                         const MmapLogFile::Options& options = MmapLogFile::Options());
+    virtual void log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) override;
+    virtual void write (const std::string& msg) override;
+    virtual void flush () override;
+    virtual std::string toYamlString() override;
+    using LogAppender::setFormatter;
+    virtual void setFormatter(const std::string& pattern) override;
+    virtual LogFormatter::ptr getWriteFormatter () override { return getFormatter(); }
+    const MmapLogFile::Options& getOptions () const { return m_file->getOptions(); }
 private:
     std::string m_filename;
-    std::fstream m_filestream;
-    uint64_t m_lastTime;
+    MmapLogFile::ptr m_file;
+};
+
+/*
+ * Formats events on the calling thread and hands the text to a background
+ * thread through a bounded lock-free ring. The background thread writes
+ * the records to the wrapped appender in batches.
+ */
+class AsyncLogAppender : public LogAppender {
+public:
+    typedef std::shared_ptr<AsyncLogAppender> ptr;
+    enum OverflowPolicy {
+        BLOCK      = 0, // wait until the background thread frees a slot
+        DROP       = 1, // drop the newest record silently
+        DROP_COUNT = 2  // drop the newest record and report the count later
+    };
+    static const char* PolicyToString(OverflowPolicy policy);
+    static OverflowPolicy PolicyFromString(const std::string& str);
+
+    AsyncLogAppender (LogAppender::ptr backend, 
+                      size_t capacity = 8192, 
+                      OverflowPolicy policy = BLOCK);
+    ~AsyncLogAppender ();
+    virtual void log (const std::shared_ptr<Logger>& logger_ptr, const LogEvent::ptr& event) override;
+    virtual void write (const std::string& msg) override;
+    // barrier: return after every record queued before the call is written
+    virtual void flush () override;
+    virtual std::string toYamlString() override;
+    virtual void setFormatter (LogFormatter::ptr formatter) override;
+    virtual void setFormatter (const std::string& pattern) override;
+    virtual LogFormatter::ptr getWriteFormatter () override { return getFormatter(); }
+    // drain the ring, flush the backend and stop the background thread
+    void stop ();
+
+    LogAppender::ptr getBackend () const { return m_backend; }
+    OverflowPolicy getPolicy () const { return m_policy; }
+    size_t getCapacity () const { return m_ring.capacity(); }
+    uint64_t getDropped () const { return m_dropped; }
+private:
+    void push (const std::string& msg);
+    // false once stopping, the caller writes the record itself
+    bool enqueue (const std::string& msg);
+    void run ();
+    void wakeup ();
+private:
+    LogAppender::ptr m_backend;
+    OverflowPolicy m_policy;
+    MPSCRingBuffer<std::string> m_ring;
+    Thread::ptr m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_sleeping;
+    std::atomic<bool> m_stopping;
+    // number of ring positions already written to the backend
+    std::atomic<uint64_t> m_written;
+    std::atomic<uint64_t> m_dropped;
+    // dropped records which have not been reported yet (DROP_COUNT)
+    std::atomic<uint64_t> m_unreported;
+    // push() calls between their m_stopping check and their tryPush
+    std::atomic<uint32_t> m_pushers;
 };
 
 typedef Singleton<LoggerManager> SltLoggerMgr;
 
+/*
+ * Enables single log statements at runtime, e.g. in yaml:
+ *   log_sites:
+ *     - file: config.cpp      # end of the path
+ *       lines: 10-40          # or line: 12
+ *     - function: LoadFromYaml
+ *       logger: system
+ * Empty fields match anything, a rule needs a file or a function.
+ * A statement may log to several loggers (a helper taking the logger as a
+ * parameter): a rule with a logger forces it on for that logger only.
+ */
+struct LogSiteRule {
+    std::string file;
+    int32_t line_begin = 0; // 0: any line
+    int32_t line_end = 0;
+    std::string function;
+    std::string logger;
+    // whether the statement at file:line in func is one of the rule's,
+    // whatever the logger
+    bool match (const char* file, int32_t line, const char* func) const;
+    bool operator== (const LogSiteRule& rule) const {
+        return file == rule.file &&
+               line_begin == rule.line_begin &&
+               line_end == rule.line_end &&
+               function == rule.function &&
+               logger == rule.logger;
+    }
+};
+
+class LogSiteRegistry {
+public:
+    typedef Mutex MutexType;
+    // register a site the first time it runs
+    void add (LogSite* site, const std::string& logger, const char* func);
+    // apply new rules to every registered site
+    void setRules (const std::vector<LogSiteRule>& rules);
+    std::string toYamlString ();
+private:
+    struct Entry {
+        LogSite* site;
+        // the first logger seen, for toYamlString()
+        std::string logger;
+    };
+    // set the state of the site from m_rules
+    void apply (LogSite* site);
+
+    MutexType m_mutex;
+    std::vector<Entry> m_sites;
+    std::vector<LogSiteRule> m_rules;
+    // logger lists of STATE_SOME sites, never freed: a reader may still use
+    // a list after the rules changed
+    std::vector<std::unique_ptr<const std::vector<std::string> > > m_loggerLists;
+};
+
+typedef Singleton<LogSiteRegistry> SltLogSiteRegistry;
+
+inline LogSite* LogSite::check (const std::shared_ptr<Logger>& logger, LogLevel::Level level, const char* func) {
+    int state = m_state.load(std::memory_order_relaxed);
+    if (SYLAR_LIKELY(state == STATE_OFF)) {
+        return SYLAR_UNLIKELY(logger->isEnabled(level)) ? this : nullptr;
+    }
+    if (state == STATE_NEW) {
+        SltLogSiteRegistry::GetInstance()->add(this, logger->getName(), func);
+    }
+    return logger->isEnabled(level) || isForced(logger->getName()) ? this : nullptr;
+}
+
+inline bool LogSite::isForced (const std::string& logger) const {
+    int state = m_state.load(std::memory_order_acquire);
+    if (state != STATE_SOME) {
+        return state == STATE_ON;
+    }
+    const std::vector<std::string>* loggers = m_loggers.load(std::memory_order_acquire);
+    return loggers && std::find(loggers->begin(), loggers->end(), logger) != loggers->end();
+}
+
 } // end of namespace
 #endif
\ No newline at end of file
@@ -0,0 +1,315 @@
+#include "log.hpp"
+
+#include <cmath>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Structured output of LogFormatter (STYLE_JSON, STYLE_LOGFMT) and kv() 
+ * fields. Kept out of log.cpp: nothing here is on the path of plain text 
+ * patterns, which rely on the std::string calls in LogFormatter::format() 
+ * being inlined.
+ */
+namespace sylar {
+
+/*
+ * --------------- LogFormatter styles ---------------
+ */
+const char* LogFormatter::StyleToString(LogFormatter::Style style) {
+    switch (style) {
+        case STYLE_JSON:
+            return "json";
+        case STYLE_LOGFMT:
+            return "logfmt";
+        default:
+            return "text";
+    }
+}
+
+LogFormatter::Style LogFormatter::StyleFromString(const std::string& str) {
+    if (str == "json") {
+        return STYLE_JSON;
+    }
+    if (str == "logfmt") {
+        return STYLE_LOGFMT;
+    }
+    if (str != "text") {
+        std::cout << "Log config error: unknown format " << str << ", use text" << std::endl;
+    }
+    return STYLE_TEXT;
+}
+
+/*
+ * --------------- Values ---------------
+ */
+static inline void AppendUInt(std::string& out, uint64_t value) {
+    char buf[24];
+    char* end = buf + sizeof(buf);
+    char* p = end;
+    do {
+        *--p = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    out.append(p, end - p);
+}
+
+static inline void AppendInt(std::string& out, int64_t value) {
+    if (value < 0) {
+        out.push_back('-');
+        AppendUInt(out, -(uint64_t)value);
+        return;
+    }
+    AppendUInt(out, value);
+}
+
+// bytes a json string has to escape; logfmt also quotes values with ' ' or '='
+static inline bool NeedsEscape(unsigned char c, bool logfmt) {
+    return c < 0x20 || c == '"' || c == '\\' || (logfmt && (c == ' ' || c == '='));
+}
+
+// index of the first byte of s which NeedsEscape(), n if there is none
+static size_t FindEscape(const char* s, size_t n, bool logfmt) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    {
+        const __m256i ctrl = _mm256_set1_epi8(0x1f);
+        const __m256i quote = _mm256_set1_epi8('"');
+        const __m256i backslash = _mm256_set1_epi8('\\');
+        const __m256i space = _mm256_set1_epi8(' ');
+        const __m256i equal = _mm256_set1_epi8('=');
+        for (; i + 32 <= n; i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(s + i));
+            // unsigned v <= 0x1f
+            __m256i m = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl), ctrl);
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quote));
+            m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, backslash));
+            if (logfmt) {
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, space));
+                m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, equal));
+            }
+            uint32_t mask = _mm256_movemask_epi8(m);
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    {
+        const __m128i ctrl = _mm_set1_epi8(0x1f);
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        const __m128i space = _mm_set1_epi8(' ');
+        const __m128i equal = _mm_set1_epi8('=');
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+            __m128i m = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl), ctrl);
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+            m = _mm_or_si128(m, _mm_cmpeq_epi8(v, backslash));
+            if (logfmt) {
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, space));
+                m = _mm_or_si128(m, _mm_cmpeq_epi8(v, equal));
+            }
+            uint32_t mask = _mm_movemask_epi8(m);
+            if (mask) {
+                return i + __builtin_ctz(mask);
+            }
+        }
+    }
+#endif
+    for (; i < n; ++i) {
+        if (NeedsEscape(s[i], logfmt)) {
+            return i;
+        }
+    }
+    return n;
+}
+
+// s with json escapes, without quotes
+static void AppendEscaped(std::string& out, const char* s, size_t n) {
+    static const char s_hex[] = "0123456789abcdef";
+    for (;;) {
+        size_t pos = FindEscape(s, n, false);
+        out.append(s, pos);
+        if (pos == n) {
+            return;
+        }
+        unsigned char c = s[pos];
+        switch (c) {
+            case '"':  out.append("\\\"", 2); break;
+            case '\\': out.append("\\\\", 2); break;
+            case '\n': out.append("\\n", 2); break;
+            case '\r': out.append("\\r", 2); break;
+            case '\t': out.append("\\t", 2); break;
+            case '\b': out.append("\\b", 2); break;
+            case '\f': out.append("\\f", 2); break;
+            default: {
+                char u[6] = { '\\', 'u', '0', '0', s_hex[c >> 4], s_hex[c & 0xf] };
+                out.append(u, 6);
+            }
+        }
+        s += pos + 1;
+        n -= pos + 1;
+    }
+}
+
+void LogFormatter::AppendValue(std::string& out, const char* s, size_t n, Style style) {
+    if (style != LogFormatter::STYLE_JSON && n && FindEscape(s, n, true) == n) {
+        out.append(s, n);
+        return;
+    }
+    out.push_back('"');
+    AppendEscaped(out, s, n);
+    out.push_back('"');
+}
+
+void LogFormatter::EscapeFrom(std::string& out, size_t begin) {
+    size_t n = out.size() - begin;
+    if (FindEscape(out.data() + begin, n, false) == n) {
+        return;
+    }
+    std::string tail(out, begin, n);
+    out.resize(begin);
+    AppendEscaped(out, tail.data(), tail.size());
+}
+
+static void AppendKey(std::string& out, const char* key, size_t n, LogFormatter::Style style, bool first) {
+    if (style == LogFormatter::STYLE_JSON) {
+        out.append(first ? "\"" : ",\"");
+        AppendEscaped(out, key, n);
+        out.append("\":", 2);
+    }
+    else {
+        if (!first) {
+            out.push_back(' ');
+        }
+        if (n == 0) {
+            out.push_back('_');
+        }
+        // logfmt keys cannot be quoted, bytes a value would escape become '_'
+        for (;;) {
+            size_t pos = FindEscape(key, n, true);
+            out.append(key, pos);
+            if (pos == n) {
+                break;
+            }
+            out.push_back('_');
+            key += pos + 1;
+            n -= pos + 1;
+        }
+        out.push_back('=');
+    }
+}
+
+void LogFormatter::AppendFields(std::string& out, const LogFields& fields, Style style, bool first) {
+    const char* data = fields.data();
+    for (auto& field : fields) {
+        AppendKey(out, data + field.key, field.key_length, style, first);
+        first = false;
+        switch (field.type) {
+            case LogFields::TYPE_INT:
+                AppendInt(out, field.i); break;
+            case LogFields::TYPE_UINT:
+                AppendUInt(out, field.u); break;
+            case LogFields::TYPE_DOUBLE:
+                if (std::isfinite(field.d)) {
+                    char tmp[32];
+                    out.append(tmp, FmtDouble(tmp, field.d));
+                }
+                else {
+                    // json has no nan or inf
+                    out.append(style == LogFormatter::STYLE_JSON ? "null" 
+                               : std::isnan(field.d) ? "NaN" : field.d > 0 ? "+Inf" : "-Inf");
+                }
+                break;
+            case LogFields::TYPE_BOOL:
+                out.append(field.b ? "true" : "false"); break;
+            case LogFields::TYPE_STRING:
+                AppendValue(out, data + field.str, field.str_length, style); break;
+        }
+    }
+}
+
+/*
+ * --------------- Structured patterns ---------------
+ * The keys become literals around the values, e.g. for json and %d%p%m:
+ *   {"time":"  %d  ","level":"  %p  ","msg":  <message>  <fields>  }\n
+ * so format() runs the same loop as for text.
+ */
+void LogFormatter::compileStructured() {
+    bool json = m_style == STYLE_JSON;
+    std::vector<Op> ops;
+    ops.swap(m_ops);
+    std::string literals;
+    literals.swap(m_literals);
+    std::string text = json ? "{" : "";
+    bool first = true;
+    for (auto& op : ops) {
+        const char* key = nullptr;
+        // string values: json quotes them, logfmt only the time
+        bool quote = false;
+        uint32_t code = op.code;
+        switch (op.code) {
+            case OP_MESSAGE:   key = "msg";    code = OP_MESSAGE_VALUE; break;
+            case OP_FILENAME:  key = "file";   code = OP_FILENAME_VALUE; break;
+            case OP_LEVEL:     key = "level";  quote = json; break;
+            case OP_DATETIME:  key = "time";   quote = true; code = OP_DATETIME_VALUE; break;
+            case OP_ELAPSE:    key = "elapse"; break;
+            case OP_THREAD_ID: key = "thread"; break;
+            case OP_THREAD_NAME: key = "thread_name"; code = OP_THREAD_NAME_VALUE; break;
+            case OP_FIBER_ID:  key = "fiber";  break;
+            case OP_LINE:      key = "line";   break;
+            case OP_MSEC:      key = "msec";   break;
+            case OP_USEC:      key = "usec";   break;
+            default:
+                // literal text, tabs and newlines
+                continue;
+        }
+        if (!first) {
+            text += json ? "," : " ";
+        }
+        first = false;
+        text += json ? std::string("\"") + key + "\":" : std::string(key) + "=";
+        if (quote) {
+            text += "\"";
+        }
+        addOp(OP_STRING, text);
+        text.clear();
+        // the time format, or nothing
+        addOp((OpCode)code, std::string(literals, op.offset, op.length));
+        if (quote) {
+            text += "\"";
+        }
+    }
+    if (!text.empty()) {
+        addOp(OP_STRING, text);
+    }
+    addOp(OP_FIELDS);
+    m_ops.back().offset = first;
+    addOp(OP_STRING, json ? "}\n" : "\n");
+}
+
+void LogFormatter::formatStructured(std::string& out, const Op& op, const LogEvent::ptr& event) {
+    switch (op.code) {
+        case OP_MESSAGE_VALUE:
+            AppendValue(out, event->getContentData(), event->getContentSize(), m_style); 
+            break;
+        case OP_FILENAME_VALUE:
+            AppendValue(out, event->getFileName(), strlen(event->getFileName()), m_style); 
+            break;
+        case OP_THREAD_NAME_VALUE:
+            AppendValue(out, event->getThreadName(), event->getThreadNameSize(), m_style); 
+            break;
+
+        case OP_FIELDS:
+            AppendFields(out, event->getFields(), m_style, op.offset); 
+            break;
+        default:
+            break;
+    }
+}
+
+}
@@ -0,0 +1,820 @@
+#include "logfile.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <list>
+#include <map>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <zlib.h>
+
+#include "utils.hpp"
+#include "singleton.hpp"
+
+namespace sylar {
+
+/*
+ * --------------- LogFileCleaner ---------------
+ *  One background thread for all LogFiles: compresses rotated files and 
+ *  removes the oldest ones, so a rotation only costs a rename() and open().
+ */
+class LogFileCleaner {
+public:
+    struct Job {
+        std::string filename;   // the live log file
+        std::string rotated;    // file to compress
+        bool compress;
+        uint32_t max_files;
+    };
+    LogFileCleaner ();
+    ~LogFileCleaner ();
+    void push (const Job& job);
+private:
+    void run ();
+    void compress (const std::string& path);
+    void removeOld (const std::string& filename, uint32_t max_files);
+private:
+    Mutex m_mutex;
+    std::list<Job> m_jobs;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_stopping;
+    Thread::ptr m_thread;
+};
+
+typedef Singleton<LogFileCleaner> SltLogFileCleaner;
+
+LogFileCleaner::LogFileCleaner ()
+: m_stopping(false) {
+    m_thread.reset(new Thread(std::bind(&LogFileCleaner::run, this), "log_cleaner"));
+}
+
+LogFileCleaner::~LogFileCleaner () {
+    m_stopping = true;
+    m_semaphore.notify();
+    m_thread->join();
+}
+
+void LogFileCleaner::push (const Job& job) {
+    {
+        Mutex::Lock lock(m_mutex);
+        m_jobs.push_back(job);
+    }
+    m_semaphore.notify();
+}
+
+void LogFileCleaner::run () {
+    for (;;) {
+        Job job;
+        {
+            Mutex::Lock lock(m_mutex);
+            if (m_jobs.empty()) {
+                if (m_stopping) {
+                    break;
+                }
+                lock.unlock();
+                m_semaphore.wait();
+                continue;
+            }
+            job = m_jobs.front();
+            m_jobs.pop_front();
+        }
+        if (job.compress) {
+            compress(job.rotated);
+        }
+        if (job.max_files) {
+            removeOld(job.filename, job.max_files);
+        }
+    }
+}
+
+void LogFileCleaner::compress (const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    std::string gz_path = path + ".gz";
+    gzFile gz = gzopen(gz_path.c_str(), "wb");
+    if (!gz) {
+        close(fd);
+        std::cout << "LogFile compress error: " << gz_path << std::endl;
+        return;
+    }
+    bool ok = true;
+    char buf[64 * 1024];
+    for (;;) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            ok = n == 0;
+            break;
+        }
+        if (gzwrite(gz, buf, n) != n) {
+            ok = false;
+            break;
+        }
+    }
+    ok = gzclose(gz) == Z_OK && ok;
+    close(fd);
+    if (ok) {
+        unlink(path.c_str());
+    }
+    else {
+        unlink(gz_path.c_str());
+        std::cout << "LogFile compress error: " << path << std::endl;
+    }
+}
+
+void LogFileCleaner::removeOld (const std::string& filename, uint32_t max_files) {
+    size_t slash = filename.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+    std::string prefix = (slash == std::string::npos ? filename : filename.substr(slash + 1)) + ".";
+    DIR* d = opendir(dir.c_str());
+    if (!d) {
+        return;
+    }
+    // "<file>.YYYYmmdd-HHMMSS[.N][.gz]", ordered by (timestamp, N)
+    typedef std::pair<std::pair<std::string, unsigned long>, std::string> Entry;
+    std::vector<Entry> rotated;
+    while (struct dirent* entry = readdir(d)) {
+        std::string name = entry->d_name;
+        if (name.size() >= prefix.size() + 15
+                && name.compare(0, prefix.size(), prefix) == 0
+                && isdigit(name[prefix.size()])
+                && name[prefix.size() + 8] == '-') {
+            const char* rest = name.c_str() + prefix.size() + 15;
+            unsigned long seq = *rest == '.' ? strtoul(rest + 1, nullptr, 10) : 0;
+            rotated.push_back(Entry(std::make_pair(name.substr(prefix.size(), 15), seq), name));
+        }
+    }
+    closedir(d);
+    if (rotated.size() <= max_files) {
+        return;
+    }
+    std::sort(rotated.begin(), rotated.end());
+    for (size_t i = 0; i + max_files < rotated.size(); ++i) {
+        const std::string& name = rotated[i].second;
+        unlink((slash == std::string::npos ? name : dir + name).c_str());
+    }
+}
+
+/*
+ * --------------- LogFile ---------------
+ */
+
+/*
+ * --------------- LogFileRegistry ---------------
+ *  The open files by canonical path. Entries are weak: a file is closed 
+ *  when its last appender goes away.
+ */
+template<class File>
+class LogFileRegistry {
+public:
+    // the file open on the path, whatever its options, or a new one
+    typename File::ptr open (const std::string& filename, const typename File::Options& options);
+private:
+    static std::string CanonicalPath (const std::string& filename);
+private:
+    Mutex m_mutex;
+    std::map<std::string, std::weak_ptr<File> > m_files;
+};
+
+template<class File>
+std::string LogFileRegistry<File>::CanonicalPath (const std::string& filename) {
+    // the file itself may not exist yet, its directory has to
+    size_t pos = filename.rfind('/');
+    std::string dir = pos == std::string::npos ? "." : filename.substr(0, pos + 1);
+    char buf[PATH_MAX];
+    if (!realpath(dir.c_str(), buf)) {
+        return filename;
+    }
+    return std::string(buf) + "/" + filename.substr(pos + 1);
+}
+
+template<class File>
+typename File::ptr LogFileRegistry<File>::open (const std::string& filename, 
+                                                const typename File::Options& options) {
+    std::string path = CanonicalPath(filename);
+    Mutex::Lock lock(m_mutex);
+    for (auto it = m_files.begin(); it != m_files.end(); ) {
+        if (it->second.expired()) {
+            it = m_files.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    auto it = m_files.find(path);
+    if (it != m_files.end()) {
+        typename File::ptr file = it->second.lock();
+        if (file) {
+            return file;
+        }
+    }
+    typename File::ptr file(new File(filename, options));
+    if (file->isOpen()) {
+        m_files[path] = file;
+    }
+    return file;
+}
+
+LogFile::ptr LogFile::Open (const std::string& filename, const Options& options,
+                            const LogFile::ptr& previous) {
+    LogFile::ptr file = Singleton<LogFileRegistry<LogFile> >::GetInstance()->open(filename, options);
+    if (!(file->getOptions() == options)) {
+        if (file == previous) {
+            file->setOptions(options);
+        }
+        else {
+            std::cout << "LogFile " << filename << " is already open with other options, "
+                      << "keeping them" << std::endl;
+        }
+    }
+    return file;
+}
+
+MmapLogFile::ptr MmapLogFile::Open (const std::string& filename, const Options& options) {
+    MmapLogFile::ptr file = Singleton<LogFileRegistry<MmapLogFile> >::GetInstance()->open(filename, options);
+    if (!(file->getOptions() == options)) {
+        std::cout << "MmapLogFile " << filename << " is already open with other options, "
+                  << "keeping them" << std::endl;
+    }
+    return file;
+}
+
+// queued buffers before a writer has to write them itself
+static const size_t s_max_pending = 16;
+// spare buffers kept after a write
+static const size_t s_max_spare = 2;
+
+const char* LogFile::SyncToString(LogFile::SyncPolicy policy) {
+    switch (policy) {
+        case LogFile::SYNC_NONE:
+            return "none"; break;
+        case LogFile::SYNC_INTERVAL:
+            return "interval"; break;
+        case LogFile::SYNC_BYTES:
+            return "bytes"; break;
+        default:
+            return "none";
+    }
+    return "none";
+}
+
+LogFile::SyncPolicy LogFile::SyncFromString(const std::string& str) {
+    if (str == "interval") {
+        return LogFile::SYNC_INTERVAL;
+    }
+    if (str == "bytes") {
+        return LogFile::SYNC_BYTES;
+    }
+    return LogFile::SYNC_NONE;
+}
+
+uint64_t LogFile::SizeFromString(const std::string& str) {
+    char* end = nullptr;
+    uint64_t size = strtoull(str.c_str(), &end, 10);
+    switch (end ? toupper(*end) : 0) {
+        case 'G':
+            size <<= 10;
+            // fallthrough
+        case 'M':
+            size <<= 10;
+            // fallthrough
+        case 'K':
+            size <<= 10;
+            break;
+        default:
+            break;
+    }
+    return size;
+}
+
+uint32_t LogFile::IntervalFromString(const std::string& str) {
+    if (str == "daily") {
+        return 24 * 3600;
+    }
+    if (str == "hourly") {
+        return 3600;
+    }
+    if (str == "minutely") {
+        return 60;
+    }
+    return strtoul(str.c_str(), nullptr, 10);
+}
+
+std::string LogFile::IntervalToString(uint32_t interval) {
+    switch (interval) {
+        case 0:
+            return "none";
+        case 24 * 3600:
+            return "daily";
+        case 3600:
+            return "hourly";
+        case 60:
+            return "minutely";
+        default:
+            return std::to_string(interval);
+    }
+}
+
+LogFile::LogFile (const std::string& filename, const Options& options)
+: m_filename(filename),
+  m_options(options),
+  m_stopping(false) {
+    openFile();
+    m_lastSync = GetCurrentMS();
+    if (m_options.buffer_size) {
+        m_current.reset(new Buffer(m_options.buffer_size));
+        m_thread.reset(new Thread(std::bind(&LogFile::run, this), "log_file"));
+    }
+}
+
+LogFile::~LogFile () {
+    if (m_thread) {
+        m_stopping = true;
+        m_semaphore.notify();
+        m_thread->join();
+    }
+    flush();
+    Mutex::Lock lock(m_ioMutex);
+    maybeSync(m_options.sync != SYNC_NONE);
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+void LogFile::append (const char* data, size_t len) {
+    bool buffered = false;
+    bool notify = false;
+    bool pending = false;
+    {
+        MutexType::Lock lock(m_mutex);
+        buffered = (bool)m_current;
+        if (buffered) {
+            if (m_current->used + len > m_current->capacity) {
+                if (m_current->used) {
+                    m_full.push_back(std::move(m_current));
+                    m_current = takeSpare();
+                }
+                notify = true;
+            }
+            if (len > m_current->capacity) {
+                // larger than a buffer, queue it on its own
+                Buffer::ptr big(new Buffer(len));
+                memcpy(big->data.get(), data, len);
+                big->used = len;
+                m_full.push_back(std::move(big));
+            }
+            else {
+                memcpy(m_current->data.get() + m_current->used, data, len);
+                m_current->used += len;
+            }
+            pending = m_full.size() > s_max_pending;
+        }
+    }
+    if (!buffered) {
+        // write through
+        Mutex::Lock lock(m_ioMutex);
+        struct iovec iov;
+        iov.iov_base = (void*)data;
+        iov.iov_len = len;
+        maybeRotate(len);
+        writeAll(&iov, 1);
+        maybeSync();
+    }
+    else if (pending) {
+        // the disk can not keep up, slow the writers down
+        writeBuffers();
+    }
+    else if (notify) {
+        m_semaphore.notify();
+    }
+}
+
+void LogFile::flush () {
+    writeBuffers();
+}
+
+void LogFile::setOptions (const Options& options) {
+    Mutex::Lock io_lock(m_ioMutex);
+    {
+        MutexType::Lock lock(m_mutex);
+        if (options.buffer_size != m_options.buffer_size) {
+            // the text so far goes out in the old buffers
+            if (m_current && m_current->used) {
+                m_full.push_back(std::move(m_current));
+            }
+            m_current.reset(options.buffer_size ? new Buffer(options.buffer_size) : nullptr);
+            m_spare.clear();
+        }
+        m_options = options;
+    }
+    writeQueued();
+    nextRotateTime();
+    if (m_options.buffer_size && !m_thread) {
+        m_thread.reset(new Thread(std::bind(&LogFile::run, this), "log_file"));
+    }
+}
+
+bool LogFile::reopen () {
+    flush();
+    Mutex::Lock lock(m_ioMutex);
+    return openFile();
+}
+
+void LogFile::rotate () {
+    flush();
+    Mutex::Lock lock(m_ioMutex);
+    rotateFile();
+}
+
+// called with m_ioMutex held (or from the constructor)
+bool LogFile::openFile () {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+    m_fd = open(m_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    struct stat st;
+    m_fileSize = m_fd >= 0 && fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    nextRotateTime();
+    return m_fd >= 0;
+}
+
+void LogFile::nextRotateTime () {
+    if (!m_options.rotate_interval) {
+        return;
+    }
+    // align the boundaries to local time, e.g. "daily" rotates at midnight
+    time_t now = time(0);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    time_t local = now + tm.tm_gmtoff;
+    m_nextRotate = (local / m_options.rotate_interval + 1) * m_options.rotate_interval 
+                   - tm.tm_gmtoff;
+}
+
+// called with m_ioMutex held
+void LogFile::maybeRotate (size_t len) {
+    if (m_fileSize == 0) {
+        // never rotate to an empty file
+        return;
+    }
+    if ((m_options.max_size && m_fileSize + len > m_options.max_size)
+            || (m_options.rotate_interval && time(0) >= m_nextRotate)) {
+        rotateFile();
+    }
+}
+
+// called with m_ioMutex held
+void LogFile::rotateFile () {
+    if (m_fd < 0 || m_fileSize == 0) {
+        return;
+    }
+    maybeSync(m_options.sync != SYNC_NONE);
+    time_t now = time(0);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), ".%Y%m%d-%H%M%S", &tm);
+    std::string rotated = m_filename + buf;
+    struct stat st;
+    for (int i = 1; stat(rotated.c_str(), &st) == 0 
+                    || stat((rotated + ".gz").c_str(), &st) == 0; ++i) {
+        rotated = m_filename + buf + "." + std::to_string(i);
+    }
+    if (rename(m_filename.c_str(), rotated.c_str())) {
+        std::cout << "LogFile rotate error: " << m_filename
+                  << " " << strerror(errno) << std::endl;
+        nextRotateTime();
+        return;
+    }
+    openFile();
+    if (m_options.compress || m_options.max_files) {
+        LogFileCleaner::Job job;
+        job.filename = m_filename;
+        job.rotated = rotated;
+        job.compress = m_options.compress;
+        job.max_files = m_options.max_files;
+        SltLogFileCleaner::GetInstance()->push(job);
+    }
+}
+
+LogFile::Buffer::ptr LogFile::takeSpare () {
+    if (m_spare.empty()) {
+        return Buffer::ptr(new Buffer(m_options.buffer_size));
+    }
+    Buffer::ptr buffer = std::move(m_spare.back());
+    m_spare.pop_back();
+    return buffer;
+}
+
+void LogFile::run () {
+    while (!m_stopping) {
+        uint32_t interval = 0;
+        {
+            MutexType::Lock lock(m_mutex);
+            interval = m_options.flush_interval;
+        }
+        m_semaphore.timedwait(interval);
+        writeBuffers();
+        // SYNC_INTERVAL also has to run when nothing new was written
+        Mutex::Lock lock(m_ioMutex);
+        maybeSync();
+    }
+}
+
+void LogFile::writeBuffers () {
+    // buffers are taken while holding m_ioMutex, so they reach the file in order
+    Mutex::Lock io_lock(m_ioMutex);
+    writeQueued();
+}
+
+// called with m_ioMutex held
+void LogFile::writeQueued () {
+    std::vector<Buffer::ptr> buffers;
+    {
+        MutexType::Lock lock(m_mutex);
+        buffers.swap(m_full);
+        if (m_current && m_current->used) {
+            buffers.push_back(std::move(m_current));
+            m_current = takeSpare();
+        }
+    }
+    if (buffers.empty()) {
+        return;
+    }
+    std::vector<struct iovec> iov(buffers.size());
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        iov[i].iov_base = buffers[i]->data.get();
+        iov[i].iov_len = buffers[i]->used;
+    }
+    if (!m_options.max_size && !m_options.rotate_interval) {
+        for (size_t i = 0; i < iov.size(); i += IOV_MAX) {
+            writeAll(&iov[i], std::min(iov.size() - i, (size_t)IOV_MAX));
+        }
+    }
+    else {
+        // one buffer at a time, so a rotation can happen between buffers
+        for (size_t i = 0; i < iov.size(); ++i) {
+            maybeRotate(iov[i].iov_len);
+            writeAll(&iov[i], 1);
+        }
+    }
+    maybeSync();
+
+    MutexType::Lock lock(m_mutex);
+    for (auto& i : buffers) {
+        if (m_spare.size() >= s_max_spare) {
+            break;
+        }
+        if (i->capacity == m_options.buffer_size) {
+            i->used = 0;
+            m_spare.push_back(std::move(i));
+        }
+    }
+}
+
+// called with m_ioMutex held
+void LogFile::writeAll (struct iovec* iov, int count) {
+    if (m_fd < 0) {
+        return;
+    }
+    while (count > 0) {
+        ssize_t n = writev(m_fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cout << "LogFile write error: " << m_filename
+                      << " " << strerror(errno) << std::endl;
+            return;
+        }
+        m_unsynced += n;
+        m_fileSize += n;
+        // skip what has been written
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// called with m_ioMutex held
+void LogFile::maybeSync (bool force) {
+    if (m_fd < 0 || !m_unsynced) {
+        return;
+    }
+    bool sync = force;
+    switch (m_options.sync) {
+        case SYNC_INTERVAL:
+            sync = sync || GetCurrentMS() - m_lastSync >= m_options.sync_interval;
+            break;
+        case SYNC_BYTES:
+            sync = sync || m_unsynced >= m_options.sync_bytes;
+            break;
+        default:
+            break;
+    }
+    if (sync) {
+        fdatasync(m_fd);
+        m_unsynced = 0;
+        m_lastSync = GetCurrentMS();
+    }
+}
+
+/*
+ * --------------- MmapLogFile ---------------
+ *  Chunk i covers the file bytes [i * chunk_size, (i + 1) * chunk_size) and 
+ *  lives in slot i % s_slots. A slot is reused only when its chunk is full,
+ *  so a writer running s_slots chunks ahead waits for the old writers.
+ */
+MmapLogFile::MmapLogFile (const std::string& filename, const Options& options)
+: m_filename(filename),
+  m_options(options),
+  m_offset(0),
+  m_broken(false),
+  m_stopping(false) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    m_options.chunk_size = std::max(m_options.chunk_size, page);
+    m_options.chunk_size = (m_options.chunk_size + page - 1) / page * page;
+    for (auto& chunk : m_chunks) {
+        chunk.index = s_unmapped;
+        chunk.written = 0;
+    }
+    m_fd = open(m_filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (m_fd < 0) {
+        return;
+    }
+    struct stat st;
+    m_start = fstat(m_fd, &st) == 0 ? st.st_size : 0;
+    m_offset = m_start;
+    m_next = m_start / m_options.chunk_size;
+    m_lastSync = GetCurrentMS();
+    remap();
+    if (m_broken) {
+        close(m_fd);
+        m_fd = -1;
+        return;
+    }
+    m_thread.reset(new Thread(std::bind(&MmapLogFile::run, this), "log_mmap"));
+}
+
+MmapLogFile::~MmapLogFile () {
+    if (m_thread) {
+        m_stopping = true;
+        m_semaphore.notify();
+        m_thread->join();
+    }
+    if (m_fd < 0) {
+        return;
+    }
+    for (auto& chunk : m_chunks) {
+        if (chunk.index != s_unmapped) {
+            munmap(chunk.base, m_options.chunk_size);
+        }
+    }
+    // drop the preallocated tail; once broken, the offset also counts
+    // messages claimed beyond the last mapped chunk, which were never copied
+    uint64_t end = m_offset;
+    if (m_broken) {
+        end = std::min<uint64_t>(end, m_next * m_options.chunk_size);
+    }
+    if (ftruncate(m_fd, end) < 0) {
+        std::cout << "MmapLogFile truncate error: " << m_filename
+                  << " " << strerror(errno) << std::endl;
+    }
+    close(m_fd);
+}
+
+void MmapLogFile::append (const char* data, size_t len) {
+    const size_t size = m_options.chunk_size;
+    if (m_broken.load(std::memory_order_relaxed)) {
+        return;
+    }
+    uint64_t pos = m_offset.fetch_add(len);
+    while (len) {
+        uint64_t index = pos / size;
+        size_t offset = pos % size;
+        size_t n = std::min(len, size - offset);
+        Chunk* chunk = waitChunk(index);
+        if (!chunk) {
+            return;
+        }
+        memcpy(chunk->base + offset, data, n);
+        // the writer finishing a chunk, and the one reaching its end, 
+        // let the helper unmap it and map one more
+        bool full = chunk->written.fetch_add(n, std::memory_order_release) + n == size;
+        if (full || offset + n == size) {
+            m_semaphore.notify();
+        }
+        pos += n;
+        data += n;
+        len -= n;
+    }
+}
+
+MmapLogFile::Chunk* MmapLogFile::waitChunk (uint64_t index) {
+    Chunk* chunk = &m_chunks[index % s_slots];
+    bool notified = false;
+    while (chunk->index.load(std::memory_order_acquire) != index) {
+        // only when the helper is behind
+        if (m_broken) {
+            return nullptr;
+        }
+        if (!notified) {
+            m_semaphore.notify();
+            notified = true;
+        }
+        sched_yield();
+    }
+    return chunk;
+}
+
+bool MmapLogFile::mapChunk (Chunk& chunk, uint64_t index) {
+    const size_t size = m_options.chunk_size;
+    off_t offset = index * size;
+    // reserve the blocks, so a full disk fails here instead of SIGBUS later
+    if (fallocate(m_fd, 0, offset, size) < 0 
+            && (errno != EOPNOTSUPP || ftruncate(m_fd, offset + size) < 0)) {
+        std::cout << "MmapLogFile fallocate error: " << m_filename
+                  << " " << strerror(errno) << std::endl;
+        return false;
+    }
+    void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, offset);
+    if (base == MAP_FAILED) {
+        std::cout << "MmapLogFile mmap error: " << m_filename
+                  << " " << strerror(errno) << std::endl;
+        return false;
+    }
+    chunk.base = (char*)base;
+    // part of the first chunk may hold the old content of the file
+    chunk.written.store((uint64_t)offset < m_start ? std::min<uint64_t>(m_start - offset, size) : 0, 
+                        std::memory_order_relaxed);
+    chunk.index.store(index, std::memory_order_release);
+    return true;
+}
+
+void MmapLogFile::remap () {
+    const size_t size = m_options.chunk_size;
+    Mutex::Lock lock(m_mutex);
+    for (auto& chunk : m_chunks) {
+        if (chunk.index.load(std::memory_order_acquire) != s_unmapped
+                && chunk.written.load(std::memory_order_acquire) == size) {
+            msync(chunk.base, size, MS_ASYNC);
+            munmap(chunk.base, size);
+            chunk.base = nullptr;
+            chunk.index.store(s_unmapped, std::memory_order_release);
+        }
+    }
+    // keep the chunk being written and the next one mapped
+    uint64_t last = m_offset.load() / size + 1;
+    while (!m_broken && m_next <= last) {
+        Chunk& chunk = m_chunks[m_next % s_slots];
+        if (chunk.index.load(std::memory_order_acquire) != s_unmapped) {
+            // its old chunk still has writers
+            break;
+        }
+        if (!mapChunk(chunk, m_next)) {
+            m_broken = true;
+            break;
+        }
+        ++m_next;
+    }
+}
+
+void MmapLogFile::flush () {
+    Mutex::Lock lock(m_mutex);
+    for (auto& chunk : m_chunks) {
+        if (chunk.index.load(std::memory_order_acquire) != s_unmapped) {
+            msync(chunk.base, m_options.chunk_size, MS_ASYNC);
+        }
+    }
+}
+
+void MmapLogFile::run () {
+    while (!m_stopping) {
+        m_semaphore.timedwait(m_options.flush_interval);
+        remap();
+        uint64_t now = GetCurrentMS();
+        if (now - m_lastSync >= m_options.flush_interval) {
+            flush();
+            m_lastSync = now;
+        }
+    }
+}
+
+}
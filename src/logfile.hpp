@@ -0,0 +1,223 @@
+#ifndef __LOGFILE_H__
+#define __LOGFILE_H__
+
+#include <cstdint>
+#include <string>
+#include <memory>
+#include <vector>
+#include <atomic>
+#include <sys/uio.h>
+
+#include "threads.hpp"
+
+namespace sylar {
+
+/*
+ * Buffered log file used by FileLogAppender. Appenders on the same path
+ * share one LogFile (see Open), so their lines go through one buffer.
+ * Writers copy messages into the current buffer under a short lock.
+ * A full buffer is queued and a fresh one takes its place,
+ * so writers never wait for the disk. A background thread writes the
+ * queued buffers with one writev() when a buffer fills up or every
+ * flush_interval milliseconds, and calls fdatasync() as the sync policy says.
+ *
+ * Rotation: before a write would grow the file past max_size, or once a 
+ * rotate_interval boundary (local time) has passed, the file is renamed 
+ * to "<file>.YYYYmmdd-HHMMSS" and a new one is opened. Compression and 
+ * removal of files beyond max_files run on a shared background thread.
+ */
+class LogFile {
+public:
+    typedef std::shared_ptr<LogFile> ptr;
+    typedef SpinLock MutexType;
+    enum SyncPolicy {
+        SYNC_NONE     = 0, // leave it to the kernel
+        SYNC_INTERVAL = 1, // fdatasync at most every sync_interval ms
+        SYNC_BYTES    = 2  // fdatasync after sync_bytes written
+    };
+    static const char* SyncToString(SyncPolicy policy);
+    static SyncPolicy SyncFromString(const std::string& str);
+    // "64M", "512K", "1G" or bytes
+    static uint64_t SizeFromString(const std::string& str);
+    // "daily", "hourly", "minutely", "none" or seconds
+    static uint32_t IntervalFromString(const std::string& str);
+    static std::string IntervalToString(uint32_t interval);
+
+    struct Options {
+        size_t buffer_size = 64 * 1024; // 0: write every message through
+        uint32_t flush_interval = 1000; // ms
+        SyncPolicy sync = SYNC_NONE;
+        uint32_t sync_interval = 1000;  // ms
+        uint64_t sync_bytes = 1 << 20;
+        uint64_t max_size = 0;          // bytes, 0: no size rotation
+        uint32_t rotate_interval = 0;   // seconds, 0: no time rotation
+        uint32_t max_files = 0;         // rotated files kept, 0: keep all
+        bool compress = true;           // gzip rotated files
+        bool operator== (const Options& opt) const {
+            return buffer_size == opt.buffer_size &&
+                   flush_interval == opt.flush_interval &&
+                   sync == opt.sync &&
+                   sync_interval == opt.sync_interval &&
+                   sync_bytes == opt.sync_bytes &&
+                   max_size == opt.max_size &&
+                   rotate_interval == opt.rotate_interval &&
+                   max_files == opt.max_files &&
+                   compress == opt.compress;
+        }
+    };
+
+    // the LogFile already open on the same path, or a new one, so a path 
+    // never has two writers. Opened with other options, the open LogFile 
+    // keeps its own, unless it is previous: the file of the appender being 
+    // reconfigured, which then takes the new ones in place.
+    static LogFile::ptr Open (const std::string& filename, const Options& options,
+                              const LogFile::ptr& previous = nullptr);
+
+    LogFile (const std::string& filename, const Options& options);
+    ~LogFile ();
+
+    bool isOpen () const { return m_fd >= 0; }
+    const std::string& getFilename () const { return m_filename; }
+    Options getOptions () {
+        MutexType::Lock lock(m_mutex);
+        return m_options;
+    }
+    // write what is buffered and go on with the new options, the file stays open
+    void setOptions (const Options& options);
+
+    void append (const char* data, size_t len);
+    // write every buffered byte to the file now
+    void flush ();
+    // close and open the file again, return True if success
+    bool reopen ();
+    // rotate now, whatever the thresholds say
+    void rotate ();
+
+private:
+    LogFile (const LogFile&) = delete;
+    LogFile& operator= (const LogFile&) = delete;
+
+    struct Buffer {
+        typedef std::unique_ptr<Buffer> ptr;
+        Buffer (size_t size) : data(new char[size]), capacity(size) {}
+        std::unique_ptr<char[]> data;
+        size_t capacity;
+        size_t used = 0;
+    };
+    Buffer::ptr takeSpare ();
+    void run ();
+    // write the queued buffers and the current one
+    void writeBuffers ();
+    void writeQueued ();
+    void writeAll (struct iovec* iov, int count);
+    void maybeSync (bool force = false);
+    bool openFile ();
+    // rotate if writing len more bytes crosses a threshold
+    void maybeRotate (size_t len);
+    void rotateFile ();
+    void nextRotateTime ();
+
+private:
+    std::string m_filename;
+    // written holding both locks, read holding either
+    Options m_options;
+    int m_fd = -1;
+    // buffers, guarded by m_mutex. No m_current: write through
+    Buffer::ptr m_current;
+    std::vector<Buffer::ptr> m_full;
+    std::vector<Buffer::ptr> m_spare;
+    MutexType m_mutex;
+    // keeps writes in queue order and guards m_fd
+    Mutex m_ioMutex;
+    uint64_t m_unsynced = 0;
+    uint64_t m_lastSync = 0;
+    uint64_t m_fileSize = 0;
+    time_t m_nextRotate = 0;
+
+    Thread::ptr m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_stopping;
+};
+
+/*
+ * Memory-mapped log file used by MmapFileLogAppender.
+ * The file grows in chunks of chunk_size bytes (fallocate + mmap). A writer
+ * reserves its bytes with one fetch_add on the file offset and memcpy()s 
+ * them into the mapping, so appending makes no system call. A message 
+ * crossing a chunk boundary is split over both chunks.
+ * Each chunk counts the bytes copied into it; once it is full, the helper 
+ * thread msync(MS_ASYNC)s and unmaps it. The helper also maps the next chunk 
+ * before writers reach it.
+ * The file is truncated to its real length on close. After a crash it may 
+ * end with zero bytes up to the last chunk boundary.
+ */
+class MmapLogFile {
+public:
+    typedef std::shared_ptr<MmapLogFile> ptr;
+    struct Options {
+        size_t chunk_size = 16 << 20;   // rounded up to the page size
+        uint32_t flush_interval = 1000; // ms between msync(MS_ASYNC) calls
+        bool operator== (const Options& opt) const {
+            return chunk_size == opt.chunk_size &&
+                   flush_interval == opt.flush_interval;
+        }
+    };
+
+    // shared per path like LogFile::Open, but other options keep the open 
+    // file: two mappings of one file would write over each other
+    static MmapLogFile::ptr Open (const std::string& filename, const Options& options);
+
+    MmapLogFile (const std::string& filename, const Options& options);
+    ~MmapLogFile ();
+
+    bool isOpen () const { return m_fd >= 0; }
+    const std::string& getFilename () const { return m_filename; }
+    const Options& getOptions () const { return m_options; }
+
+    void append (const char* data, size_t len);
+    // msync(MS_ASYNC) the mapped chunks
+    void flush ();
+
+private:
+    MmapLogFile (const MmapLogFile&) = delete;
+    MmapLogFile& operator= (const MmapLogFile&) = delete;
+
+    static const uint64_t s_unmapped = ~0ull;
+    static const size_t s_slots = 4;
+    struct Chunk {
+        // index of the chunk mapped in this slot
+        std::atomic<uint64_t> index;
+        char* base = nullptr;
+        // bytes copied into the chunk so far
+        std::atomic<size_t> written;
+    };
+    Chunk* waitChunk (uint64_t index);
+    bool mapChunk (Chunk& chunk, uint64_t index);
+    // unmap full chunks and map the next ones
+    void remap ();
+    void run ();
+
+private:
+    std::string m_filename;
+    Options m_options;
+    int m_fd = -1;
+    // where the next message goes
+    std::atomic<uint64_t> m_offset;
+    // file length at open, bytes before it count as written
+    uint64_t m_start = 0;
+    // next chunk to map, guarded by m_mutex
+    uint64_t m_next = 0;
+    Chunk m_chunks[s_slots];
+    // guards the mappings against flush()
+    Mutex m_mutex;
+    std::atomic<bool> m_broken;
+    uint64_t m_lastSync = 0;
+
+    Thread::ptr m_thread;
+    Semaphore m_semaphore;
+    std::atomic<bool> m_stopping;
+};
+
+}
+
+#endif
@@ -4,5 +4,13 @@
 #include <cstring>
 #include <cassert>
 
+// branch hints
+#if defined(__GNUC__) || defined(__clang__)
+#define SYLAR_LIKELY(x)   __builtin_expect(!!(x), 1)
+#define SYLAR_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#else
+#define SYLAR_LIKELY(x)   (x)
+#define SYLAR_UNLIKELY(x) (x)
+#endif
 
 #endif
\ No newline at end of file
@@ -0,0 +1,115 @@
+#ifndef __RINGBUFFER_H__
+#define __RINGBUFFER_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <memory>
+#include <utility>
+
+namespace sylar {
+
+/*
+ * Bounded lock-free ring buffer: many producers, one consumer.
+ * Every slot carries a sequence number (Dmitry Vyukov's bounded queue),
+ *   seq == pos        -> slot is free for the producer claiming pos
+ *   seq == pos + 1    -> slot holds the value written for pos
+ * Producers claim a position with a CAS on m_head, the consumer owns m_tail.
+ */
+template<class T>
+class MPSCRingBuffer {
+public:
+    // capacity is rounded up to a power of two
+    MPSCRingBuffer(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        m_mask = size - 1;
+        m_slots.reset(new Slot[size]);
+        for (size_t i = 0; i < size; ++i) {
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+        }
+        m_head.store(0, std::memory_order_relaxed);
+        m_tail.store(0, std::memory_order_relaxed);
+    }
+
+    // producers: return false if the ring is full
+    // the value is assigned into the slot, so slot storage can be reused
+    template<class U>
+    bool tryPush(U&& value) {
+        uint64_t pos = m_head.load(std::memory_order_relaxed);
+        Slot* slot;
+        for (;;) {
+            slot = &m_slots[pos & m_mask];
+            uint64_t seq = slot->seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t)seq - (int64_t)pos;
+            if (diff == 0) {
+                if (m_head.compare_exchange_weak(pos, pos + 1)) {
+                    break;
+                }
+            }
+            else if (diff < 0) {
+                // the consumer has not released this slot yet
+                return false;
+            }
+            else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->value = std::forward<U>(value);
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only: call func on the next value in place, 
+    // return false if nothing is ready
+    template<class F>
+    bool tryConsume(F func) {
+        uint64_t pos = m_tail.load(std::memory_order_relaxed);
+        Slot* slot = &m_slots[pos & m_mask];
+        uint64_t seq = slot->seq.load(std::memory_order_acquire);
+        if ((int64_t)seq - (int64_t)(pos + 1) < 0) {
+            return false;
+        }
+        func(slot->value);
+        slot->seq.store(pos + m_mask + 1, std::memory_order_release);
+        m_tail.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only: return false if nothing is ready
+    bool tryPop(T& value) {
+        return tryConsume([&value](T& v) { value = std::move(v); });
+    }
+
+    // number of positions claimed by producers so far
+    uint64_t pushed() const { return m_head.load(); }
+    // number of positions released by the consumer so far
+    uint64_t popped() const { return m_tail.load(); }
+    bool empty() const { return pushed() == popped(); }
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    MPSCRingBuffer(const MPSCRingBuffer&) = delete;
+    MPSCRingBuffer& operator=(const MPSCRingBuffer&) = delete;
+
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        T value;
+    };
+    std::unique_ptr<Slot[]> m_slots;
+    size_t m_mask;
+    // keep producer and consumer counters on different cache lines;
+    // padded by hand, the ring lives in heap objects and C++11 new
+    // does not honour alignas(64)
+    char m_pad0[64];
+    std::atomic<uint64_t> m_head;
+    char m_pad1[64 - sizeof(std::atomic<uint64_t>)];
+    std::atomic<uint64_t> m_tail;
+    char m_pad2[64 - sizeof(std::atomic<uint64_t>)];
+};
+
+}
+
+#endif
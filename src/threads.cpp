@@ -40,6 +40,25 @@ void Semaphore::wait() {
             throw std::logic_error("sem_wait error");
         }
 }
+bool Semaphore::timedwait(uint64_t ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec += 1;
+        ts.tv_nsec -= 1000000000;
+    }
+    while (sem_timedwait(&m_semaphore, &ts)) {
+        if (errno == ETIMEDOUT) {
+            return false;
+        }
+        if (errno != EINTR) {
+            throw std::logic_error("sem_timedwait error");
+        }
+    }
+    return true;
+}
 void Semaphore::notify() {
     if (sem_post(&m_semaphore)) {
         throw std::logic_error("sem_post error");
@@ -62,6 +81,7 @@ void Thread::SetName(const std::string& name) {
         t_thread->m_name = name;
     }
     t_thread_name = name;
+    SetThreadName(name);
 }
 
 Thread::Thread(std::function<void()> callback, const std::string& name)
@@ -105,6 +125,7 @@ void* Thread::run (void* arg) {
     Thread* thread = (Thread*) arg;
     t_thread = thread;
     t_thread_name = thread->m_name;
+    SetThreadName(thread->m_name);
     thread->m_id = GetThreadID();
     pthread_setname_np(pthread_self(), thread->m_name.substr(0,15).c_str());
     std::function<void()> callback;
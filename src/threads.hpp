@@ -6,6 +6,8 @@
 #include <semaphore.h>
 #include <cerrno>
 #include <atomic>
+#include <memory>
+#include <string>
 #include "utils.hpp"
 
 namespace sylar {
@@ -15,6 +17,8 @@ public:
     Semaphore(uint32_t count = 0);
     ~Semaphore();
     void wait();
+    // return false if not notified within ms milliseconds
+    bool timedwait(uint64_t ms);
     void notify();
 
 private:
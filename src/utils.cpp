@@ -1,5 +1,13 @@
 #include "utils.hpp"
 #include <execinfo.h>
+#include <dlfcn.h>
+#include <cxxabi.h>
+#include <time.h>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include <pthread.h>
+#include <sys/prctl.h>
 
 #include "log.hpp"
 
@@ -7,32 +15,160 @@ namespace sylar {
 
 sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
 
-pid_t GetThreadID() { return syscall(SYS_gettid); }
+// zero-initialized, no thread_local constructor to run
+static thread_local ThreadIdentity t_identity;
 
-uint32_t GetFiberID() { return 0; }
+// a forked child has a new tid
+static int s_identity_init = []() {
+    pthread_atfork(nullptr, nullptr, []() { t_identity.id = 0; });
+    return 0;
+}();
 
-void BackTrace(std::vector<std::string>& bt, int size, int skip) {
-    void** array = (void**)malloc(sizeof(void*) * size);
-    size_t s = backtrace(array, size);
+static ThreadIdentity& LocalIdentity() {
+    ThreadIdentity& identity = t_identity;
+    if (SYLAR_UNLIKELY(identity.id == 0)) {
+        identity.id = syscall(SYS_gettid);
+        if (identity.name_size == 0) {
+            // the name given with pthread_setname_np, or the program's
+            char name[16] = {0};
+            prctl(PR_GET_NAME, name);
+            identity.name_size = strnlen(name, sizeof(name) - 1);
+            memcpy(identity.name, name, identity.name_size);
+        }
+    }
+    return identity;
+}
 
-    char** strings = backtrace_symbols(array, s);
-    if (strings == NULL) {
-        SYLAR_LOG_ERROR(g_logger) << "backtrace_symbols error";
-        return;
+const ThreadIdentity& GetThreadIdentity() { return LocalIdentity(); }
+
+pid_t GetThreadID() { return LocalIdentity().id; }
+
+uint32_t GetFiberID() { return t_identity.fiber_id; }
+
+void SetFiberID(uint32_t id) { t_identity.fiber_id = id; }
+
+void SetThreadName(const std::string& name) {
+    ThreadIdentity& identity = LocalIdentity();
+    identity.name_size = std::min(name.size(), sizeof(identity.name));
+    memcpy(identity.name, name.data(), identity.name_size);
+}
+
+static uint64_t ClockUS(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+uint64_t GetCurrentUS() {
+    // the offset is taken again every second to follow wall clock changes, 
+    // in between the time of a thread never goes backwards
+    static thread_local uint64_t t_anchor = 0;
+    static thread_local uint64_t t_offset = 0;
+    uint64_t now = ClockUS(CLOCK_MONOTONIC);
+    if (t_anchor == 0 || now - t_anchor >= 1000000) {
+        t_anchor = now;
+        t_offset = ClockUS(CLOCK_REALTIME) - now;
+    }
+    return now + t_offset;
+}
+
+uint64_t GetCurrentMS() {
+    return GetCurrentUS() / 1000;
+}
+
+// the first backtrace() loads libgcc_s, which allocates; 
+// do it at startup so later captures are safe in signal handlers
+static int s_backtrace_init = []() {
+    void* frame;
+    backtrace(&frame, 1);
+    return 0;
+}();
+
+// a single call site keeps the skipped frame count right
+__attribute__((noinline)) int BackTraceCapture(void** frames, int size, int skip) {
+    static const int kMaxFrames = 128;
+    void* buf[kMaxFrames];
+    if (size <= 0 || skip < 0) {
+        return 0;
+    }
+    // one more for this function
+    skip += 1;
+    int n = backtrace(buf, std::min(size + skip, kMaxFrames));
+    if (n <= skip) {
+        return 0;
     }
-    for (size_t i = skip; i < s; ++i) {
-        bt.push_back(std::to_string(int(s)));
+    n = std::min(n - skip, size);
+    memcpy(frames, buf + skip, sizeof(void*) * n);
+    return n;
+}
+
+static std::string Symbolize(void* address) {
+    std::stringstream ss;
+    Dl_info info;
+    if (!dladdr(address, &info)) {
+        ss << "[" << address << "]";
+        return ss.str();
+    }
+    ss << (info.dli_fname ? info.dli_fname : "");
+    if (info.dli_sname) {
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        ss << "(" << (status == 0 && demangled ? demangled : info.dli_sname)
+           << "+0x" << std::hex << ((char*)address - (char*)info.dli_saddr) << ")";
+        free(demangled);
+    }
+    else {
+        // not exported, the offset into the module still resolves with addr2line
+        ss << "(+0x" << std::hex << ((char*)address - (char*)info.dli_fbase) << ")";
+    }
+    ss << " [" << address << "]";
+    return ss.str();
+}
+
+// return addresses are few, the cache stops growing past this anyway
+static const size_t kSymbolCacheMax = 1 << 16;
+
+std::string BackTraceSymbol(void* address) {
+    static Mutex_RW s_mutex;
+    static std::unordered_map<void*, std::string> s_cache;
+    {
+        Mutex_RW::ReadLock lock(s_mutex);
+        auto it = s_cache.find(address);
+        if (it != s_cache.end()) {
+            return it->second;
+        }
+    }
+    std::string symbol = Symbolize(address);
+    Mutex_RW::WriteLock lock(s_mutex);
+    if (s_cache.size() < kSymbolCacheMax) {
+        s_cache.emplace(address, symbol);
+    }
+    return symbol;
+}
+
+void BackTraceSymbolize(void* const* frames, int n, std::vector<std::string>& bt) {
+    bt.reserve(bt.size() + std::max(n, 0));
+    for (int i = 0; i < n; ++i) {
+        bt.push_back(BackTraceSymbol(frames[i]));
+    }
+}
+
+__attribute__((noinline)) void BackTrace(std::vector<std::string>& bt, int size, int skip) {
+    if (size <= 0) {
+        return;
     }
-    free(strings);
-    free(array);
+    std::vector<void*> frames(size);
+    // skip this function too
+    int n = BackTraceCapture(&frames[0], size, skip + 1);
+    BackTraceSymbolize(&frames[0], n, bt);
 }
 
-std::string BackTraceToString(int size, int skip, const std::string& prefix) {
+__attribute__((noinline)) std::string BackTraceToString(int size, int skip, const std::string& prefix) {
     std::vector<std::string> bt;
-    BackTrace(bt, size, skip);
+    BackTrace(bt, size, skip + 1);
     std::stringstream ss;
     for (size_t i = 0; i < bt.size(); ++i) {
-        ss << bt[i] << std::endl;
+        ss << prefix << bt[i] << std::endl;
     }
     return ss.str();
 }
@@ -13,8 +13,40 @@
 
 namespace sylar {
 
+/*
+ * What the logger needs to know about the calling thread, kept in a 
+ * thread_local block: the tid is taken with one system call on first use 
+ * (again in a forked child), the name comes from Thread or prctl.
+ */
+struct ThreadIdentity {
+    pid_t id;
+    uint32_t fiber_id;
+    uint32_t name_size;
+    char name[32];
+};
+
+const ThreadIdentity& GetThreadIdentity();
 pid_t GetThreadID();
 uint32_t GetFiberID();
+void SetFiberID(uint32_t id);
+// truncated to sizeof(ThreadIdentity::name) bytes
+void SetThreadName(const std::string& name);
+
+// wall clock time since the epoch, 
+// CLOCK_MONOTONIC plus a per-thread offset to CLOCK_REALTIME
+uint64_t GetCurrentUS();
+uint64_t GetCurrentMS();
+
+// stores up to size return addresses of the caller's stack into frames, 
+// skipping the innermost skip frames, returns the number stored.
+// no allocation and no lock, can be called from a signal handler
+int BackTraceCapture(void** frames, int size, int skip = 0);
+
+// "module(symbol+0xoffset) [address]" with a demangled symbol, 
+// looked up with dladdr and cached by address
+std::string BackTraceSymbol(void* address);
+
+void BackTraceSymbolize(void* const* frames, int n, std::vector<std::string>& bt);
 
 void BackTrace(std::vector<std::string>& bt, int size, int skip);
 
@@ -1,6 +1,9 @@
+#include <cassert>
 #include "config.hpp"
 #include "log.hpp"
 #include <yaml-cpp/yaml.h>
+#include <thread>
+#include <atomic>
 
 /*
 sylar::ConfigVar<int>::ptr g_int_val_config 
@@ -139,11 +142,12 @@ public:
 namespace sylar {
 
 // Full Template Specialization
+// FromNode / ToNode let the containers of Person (class.map, class.mapvec)
+// convert their elements without going through strings
 template<>
-class LexicalCast<std::string, Person> {
+class FromNode<Person> {
 public:
-    Person operator() (const std::string& string) {
-        YAML::Node node = YAML::Load(string);
+    Person operator() (const YAML::Node& node) {
         Person p;
         p.m_name = node["name"].as<std::string>();
         p.m_age = node["age"].as<int>();
@@ -153,15 +157,32 @@ public:
 };
 
 template<>
-class LexicalCast<Person, std::string> {
+class ToNode<Person> {
 public:
-    std::string operator() (const Person& p) {
+    YAML::Node operator() (const Person& p) {
         YAML::Node node;
         node["name"] = p.m_name;
         node["age"] = p.m_age;
         node["sex"] = p.m_sex;
+        return node;
+    }
+};
+
+// the string forms, for ConfigVar<Person> itself
+template<>
+class LexicalCast<std::string, Person> {
+public:
+    Person operator() (const std::string& string) {
+        return FromNode<Person>() (YAML::Load(string));
+    }
+};
+
+template<>
+class LexicalCast<Person, std::string> {
+public:
+    std::string operator() (const Person& p) {
         std::stringstream ss;
-        ss << node;
+        ss << ToNode<Person>() (p);
         return ss.str();
     }
 };
@@ -225,12 +246,91 @@ void test_log() {
     SYLAR_LOG_INFO(system_log) << "hello system" << std::endl;
 }
 
+// readers keep a snapshot or a per-thread cache while the value is reloaded
+void test_snapshot() {
+    static sylar::ConfigVar<std::vector<int> >::ptr vec_config
+        = sylar::Config::Lookup("system.snapshot_vec", std::vector<int> {1, 2, 3}, "snapshot vector");
+    sylar::ConfigVar<std::vector<int> >::ConstPtr before = vec_config->getSnapshot();
+    static thread_local sylar::ConfigVar<std::vector<int> >::LocalCache s_cache(vec_config);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "version " << vec_config->getVersion() << " size " << s_cache.get().size();
+
+    std::vector<std::thread> readers;
+    std::atomic<bool> stop(false);
+    for (int i = 0; i != 4; ++i) {
+        readers.push_back(std::thread([&stop]() {
+            sylar::ConfigVar<std::vector<int> >::LocalCache cache(vec_config);
+            size_t reads = 0;
+            while (!stop.load()) {
+                const std::vector<int>& v = cache.get();
+                // a snapshot is never half written
+                assert(v.back() == (int)v.size());
+                ++reads;
+            }
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "reads " << reads;
+        }));
+    }
+    for (int n = 4; n != 1000; ++n) {
+        std::vector<int> v;
+        for (int i = 1; i <= n; ++i) {
+            v.push_back(i);
+        }
+        vec_config->setValue(v);
+    }
+    stop = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    // the old snapshot is still alive and unchanged, the cache sees the last value
+    assert(before->size() == 3);
+    assert(s_cache.get().size() == 999);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "before " << before->size()
+        << " now " << vec_config->getSnapshot()->size()
+        << " cached " << s_cache.get().size()
+        << " version " << vec_config->getVersion();
+}
+
+// an incremental load only converts and notifies the names whose content changed
+static int a_calls = 0;
+static int b_calls = 0;
+void test_incremental() {
+    static sylar::ConfigVar<std::map<std::string, int> >::ptr a_config
+        = sylar::Config::Lookup("reload.a", std::map<std::string, int> (), "reload a");
+    static sylar::ConfigVar<std::map<std::string, int> >::ptr b_config
+        = sylar::Config::Lookup("reload.b", std::map<std::string, int> (), "reload b");
+    a_config->addListener([](const std::map<std::string, int>& old_value, const std::map<std::string, int>& new_value) {
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "reload.a changed";
+        ++a_calls;
+    });
+    b_config->addListener([](const std::map<std::string, int>& old_value, const std::map<std::string, int>& new_value) {
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "reload.b changed";
+        ++b_calls;
+    });
+    sylar::Config::LoadFromYaml(YAML::Load("reload: {a: {x: 1}, b: {y: 2}}"));
+    assert(a_calls == 1 && b_calls == 1);
+    // only reload.b is converted again
+    sylar::Config::LoadFromYaml(YAML::Load("reload: {a: {x: 1}, b: {y: 3}}"), true);
+    assert(a_calls == 1 && b_calls == 2);
+    assert(b_config->getValue().at("y") == 3);
+    // reload.a is skipped, not converted to an equal value: 
+    // a value set in between survives an incremental load, not a full one
+    a_config->setValue(std::map<std::string, int> {{"x", 5}});
+    assert(a_calls == 2);
+    sylar::Config::LoadFromYaml(YAML::Load("reload: {a: {x: 1}, b: {y: 3}}"), true);
+    assert(a_calls == 2 && a_config->getValue().at("x") == 5);
+    sylar::Config::LoadFromYaml(YAML::Load("reload: {a: {x: 1}, b: {y: 3}}"));
+    assert(a_calls == 3 && a_config->getValue().at("x") == 1);
+    assert(b_calls == 2);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << a_config->toString() << b_config->toString();
+}
+
 int main(int argc, char* argv[]){
 	SYLAR_LOG_ALL(SYLAR_LOG_ROOT()) << "config test\n";
     // test_yaml();
     // test_config();
     // test_class();
     // test_callback();
+    test_snapshot();
+    test_incremental();
     test_log();
     SYLAR_LOG_ALL(SYLAR_LOG_ROOT()) << "config finished";
     return 0;
@@ -1,5 +1,7 @@
 #include <iostream>
 #include "log.hpp" 
+#include "binlog.hpp"
+#include "flightrecorder.hpp"
 #include "utils.hpp"
 #include "config.hpp"
 
@@ -23,7 +25,7 @@ int main(int argc, char* argv[]){
 	std::shared_ptr<Logger> logger (new Logger("demo"));
 	logger->addAppender(stdapp);
 	logger->addAppender(fileapp);
-	LogEvent::ptr event( new LogEvent(logger, LogLevel::ALL, __FILE__, __LINE__, 0, GetThreadID(), GetFiberID(), time(0)) );
+	LogEvent::ptr event( new LogEvent(logger, LogLevel::ALL, __FILE__, __LINE__, GetThreadID(), GetFiberID(), 0, time(0)) );
 	event->getSS() << "test stringstream";
 	logger->log(LogLevel::ALL, event);
 	
@@ -33,5 +35,44 @@ int main(int argc, char* argv[]){
 	auto l = SltLoggerMgr::GetInstance()->getLogger("test");
 	SYLAR_LOG_LEVEL(l, LogLevel::ALL) << "test mgr";
 
+	// asynchronous appender
+	AsyncLogAppender::ptr asyncapp (new AsyncLogAppender(stdapp, 1024, AsyncLogAppender::DROP_COUNT));
+	std::shared_ptr<Logger> async_logger (new Logger("async"));
+	async_logger->addAppender(asyncapp);
+	for (int i = 0; i < 10; ++i) {
+		SYLAR_LOG_LEVEL(async_logger, LogLevel::ALL) << "test async " << i;
+	}
+	asyncapp->flush();
+	std::cout << "async dropped: " << asyncapp->getDropped() << std::endl;
+
+	// throttled statements
+	for (int i = 0; i < 10; ++i) {
+		SYLAR_LOG_ERROR_EVERY_N(logger, 5) << "test every n " << i;
+		SYLAR_LOG_RATE_LIMITED(logger, LogLevel::ERROR, 1, 2) << "test rate limited " << i;
+	}
+
+	// structured lines with typed fields
+	LogAppender::ptr jsonapp (new StdoutLogAppender);
+	jsonapp->setFormatter(LogFormatter::ptr(new LogFormatter(pattern, LogFormatter::STYLE_JSON)));
+	std::shared_ptr<Logger> json_logger (new Logger("json"));
+	json_logger->addAppender(jsonapp);
+	SYLAR_LOG_INFO(json_logger).kv("uid", 42).kv("path", "/a \"b\"").kv("ratio", 0.5) << "test json";
+
+	// binary records, decode with: sylar_logdecode ../data/log.bin
+	std::shared_ptr<Logger> bin_logger (new Logger("binary"));
+	bin_logger->setBinarySink(BinLogSink::ptr(new BinLogSink("../data/log.bin", "binary")));
+	for (int i = 0; i < 10; ++i) {
+		SYLAR_LOG_BIN_INFO(bin_logger, "test binary %d %s %.2f", i, "str", i * 0.5);
+	}
+
+	// recorded, not printed: the logger is at INFO
+	FlightRecorder* recorder = SltFlightRecorder::GetInstance();
+	recorder->setLevel(LogLevel::DEBUG);
+	logger->setLevel(LogLevel::INFO);
+	for (int i = 0; i < 10; ++i) {
+		SYLAR_LOG_DEBUG(logger) << "test recorder " << i;
+	}
+	recorder->dump("../data/recorder.txt");
+
 	return 0; 
 }
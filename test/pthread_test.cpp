@@ -50,9 +50,9 @@ int main (int argc, char* argv[]) {
 
     g_logger->clearAppender();
     g_logger->addAppender(sylar::LogAppender::ptr(new sylar::FileLogAppender("../data/log.txt")));
-    clock_t start, end;
+    uint64_t start, end;
     std::vector<sylar::Thread::ptr> thrs;
-    start = clock(); // time of starting
+    start = sylar::GetCurrentUS(); // wall time of starting
     for (int i = 0; i < 4; ++i) {
         sylar::Thread::ptr thr(new sylar::Thread(&fun2, "name_" + std::to_string(i*2)));
         sylar::Thread::ptr thr_2(new sylar::Thread(&fun3, "name_" + std::to_string(i*2+1)));
@@ -63,7 +63,7 @@ int main (int argc, char* argv[]) {
     for (int i = 0; i < thrs.size(); ++i) { 
         thrs[i]->join();
     }
-    end = clock(); // time of the end;
+    end = sylar::GetCurrentUS(); // wall time of the end
     SYLAR_LOG_INFO(g_logger) << "cout: " << count;
     g_logger->clearAppender();
     g_logger->addAppender(sylar::LogAppender::ptr(new sylar::StdoutLogAppender()));
@@ -75,6 +75,6 @@ int main (int argc, char* argv[]) {
                                  << " value=\n" << var->toString();
     });
     SYLAR_LOG_INFO(g_logger) << "thread test end";
-    SYLAR_LOG_INFO(g_logger) << "running time: " << double(end-start)/CLOCKS_PER_SEC <<"s";
+    SYLAR_LOG_INFO(g_logger) << "running time: " << (end - start) / 1e6 << "s";
     return 0;
 }
\ No newline at end of file
@@ -8,7 +8,20 @@ void test_backtrace(){
     SYLAR_LOG_INFO(g_logger) << sylar::BackTraceToString(10, 0, "    ");
 }
 
+void test_backtrace_capture(){
+    // capture is cheap, symbols are looked up only when printed
+    void* frames[16];
+    int n = sylar::BackTraceCapture(frames, 16);
+    std::vector<std::string> bt;
+    sylar::BackTraceSymbolize(frames, n, bt);
+    assert(!bt.empty());
+    for (auto& s : bt) {
+        SYLAR_LOG_INFO(g_logger) << s;
+    }
+}
+
 int main() {
     test_backtrace();
+    test_backtrace_capture();
     return 0;
 }
\ No newline at end of file
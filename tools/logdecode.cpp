@@ -0,0 +1,303 @@
+/*
+ * Turn a binary log (see binlog.hpp) back into text.
+ * usage: sylar_logdecode [-p pattern] file...
+ * The pattern is a LogFormatter pattern, the default is the one of LogFormatter.
+ * Reads stdin when no file is given.
+ */
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+#include <iostream>
+#include <fstream>
+#include <iterator>
+#include "binlog.hpp"
+
+using namespace sylar;
+
+struct Site {
+    LogLevel::Level level;
+    int32_t line;
+    std::string file;
+    std::string fmt;
+};
+
+struct Arg {
+    char type;
+    uint64_t value;     // ARG_INT, ARG_UINT, ARG_POINTER
+    double real;        // ARG_DOUBLE
+    std::string str;    // ARG_STRING
+};
+
+// read the arguments of one event, return false if the record is cut
+static bool ReadArgs(const char* p, const char* end, std::vector<Arg>& args) {
+    args.clear();
+    while (p < end) {
+        Arg arg;
+        arg.type = *p++;
+        switch (arg.type) {
+            case BinLogSink::ARG_INT:
+            case BinLogSink::ARG_UINT:
+            case BinLogSink::ARG_POINTER:
+                if (end - p < 8) {
+                    return false;
+                }
+                memcpy(&arg.value, p, 8);
+                p += 8;
+                break;
+            case BinLogSink::ARG_DOUBLE:
+                if (end - p < 8) {
+                    return false;
+                }
+                memcpy(&arg.real, p, 8);
+                p += 8;
+                break;
+            case BinLogSink::ARG_STRING: {
+                uint32_t len;
+                if (end - p < 4) {
+                    return false;
+                }
+                memcpy(&len, p, 4);
+                p += 4;
+                if ((size_t)(end - p) < len) {
+                    return false;
+                }
+                arg.str.assign(p, len);
+                p += len;
+                break;
+            }
+            default:
+                return false;
+        }
+        args.push_back(arg);
+    }
+    return true;
+}
+
+template<class T>
+static void AppendFormat(std::string& out, const std::string& spec, T value) {
+    char buf[128];
+    int n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    if (n < 0) {
+        return;
+    }
+    if ((size_t)n < sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    std::string big(n + 1, '\0');
+    snprintf(&big[0], big.size(), spec.c_str(), value);
+    out.append(big.data(), n);
+}
+
+static int64_t IntOf(const Arg& arg) {
+    return arg.type == BinLogSink::ARG_DOUBLE ? (int64_t)arg.real : (int64_t)arg.value;
+}
+
+static double RealOf(const Arg& arg) {
+    if (arg.type == BinLogSink::ARG_DOUBLE) {
+        return arg.real;
+    }
+    return arg.type == BinLogSink::ARG_INT ? (double)(int64_t)arg.value : (double)arg.value;
+}
+
+/*
+ * printf with recorded arguments: every conversion is rebuilt without its
+ * length modifier and run through snprintf with the recorded value
+ */
+static std::string Render(const std::string& fmt, const std::vector<Arg>& args) {
+    std::string out;
+    size_t next = 0;
+    for (size_t i = 0; i < fmt.size(); ++i) {
+        if (fmt[i] != '%') {
+            out.push_back(fmt[i]);
+            continue;
+        }
+        if (i + 1 < fmt.size() && fmt[i + 1] == '%') {
+            out.push_back('%');
+            ++i;
+            continue;
+        }
+        std::string spec = "%";
+        size_t j = i + 1;
+        while (j < fmt.size() && strchr("-+ #0'", fmt[j])) {
+            spec.push_back(fmt[j++]);
+        }
+        // width and precision, '*' takes an argument
+        for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (j >= fmt.size() || fmt[j] != '.') {
+                    break;
+                }
+                spec.push_back(fmt[j++]);
+            }
+            if (j < fmt.size() && fmt[j] == '*') {
+                ++j;
+                spec += std::to_string(next < args.size() ? IntOf(args[next++]) : 0);
+            }
+            while (j < fmt.size() && isdigit(fmt[j])) {
+                spec.push_back(fmt[j++]);
+            }
+        }
+        while (j < fmt.size() && strchr("hlLqjzt", fmt[j])) {
+            ++j;
+        }
+        if (j >= fmt.size()) {
+            out.append(fmt, i, std::string::npos);
+            break;
+        }
+        char conv = fmt[j];
+        i = j;
+        if (next >= args.size()) {
+            out.append("<?>");
+            continue;
+        }
+        const Arg& arg = args[next++];
+        switch (conv) {
+            case 'd':
+            case 'i':
+                AppendFormat(out, spec + "lld", (long long)IntOf(arg));
+                break;
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                AppendFormat(out, spec + "ll" + conv, (unsigned long long)IntOf(arg));
+                break;
+            case 'c':
+                AppendFormat(out, spec + "c", (int)IntOf(arg));
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                AppendFormat(out, spec + conv, RealOf(arg));
+                break;
+            case 's':
+                if (arg.type == BinLogSink::ARG_STRING) {
+                    AppendFormat(out, spec + "s", arg.str.c_str());
+                }
+                else {
+                    out.append("<?>");
+                }
+                break;
+            case 'p':
+                AppendFormat(out, spec + "p", (void*)(uintptr_t)arg.value);
+                break;
+            default:
+                // %n and unknown conversions print nothing
+                break;
+        }
+    }
+    return out;
+}
+
+static void Decode(const std::string& data, LogFormatter::ptr formatter) {
+    std::unordered_map<uint32_t, Site> sites;
+    Logger::ptr logger(new Logger("root"));
+    std::vector<Arg> args;
+    std::string out;
+    size_t pos = 0;
+    while (pos + 8 <= data.size()) {
+        const char* p = data.data() + pos;
+        uint32_t size;
+        uint32_t type;
+        memcpy(&size, p, 4);
+        memcpy(&type, p + 4, 4);
+        if (size < 8 || pos + size > data.size()) {
+            std::cerr << "sylar_logdecode: truncated record at " << pos << std::endl;
+            return;
+        }
+        const char* end = p + size;
+        pos += size;
+        if (type == BinLogSink::RECORD_HEADER) {
+            if (size < 16 || memcmp(p + 8, "SYLB", 4) != 0) {
+                std::cerr << "sylar_logdecode: bad header" << std::endl;
+                return;
+            }
+            // another sink on the file may still write the sites it defined, 
+            // and a new process redefines every id before using it
+            logger.reset(new Logger(std::string(p + 16, strnlen(p + 16, end - p - 16))));
+            continue;
+        }
+        if (type == BinLogSink::RECORD_SITE) {
+            if (size < 20) {
+                continue;
+            }
+            uint32_t id;
+            uint32_t level;
+            Site site;
+            memcpy(&id, p + 8, 4);
+            memcpy(&level, p + 12, 4);
+            memcpy(&site.line, p + 16, 4);
+            site.level = (LogLevel::Level)level;
+            const char* str = p + 20;
+            site.file.assign(str, strnlen(str, end - str));
+            str += site.file.size() + 1;
+            if (str < end) {
+                site.fmt.assign(str, strnlen(str, end - str));
+            }
+            sites[id] = site;
+            continue;
+        }
+        auto it = sites.find(type);
+        BinLogSink::EventHeader header;
+        if (it == sites.end() || size < sizeof(header)) {
+            std::cerr << "sylar_logdecode: unknown site " << type << std::endl;
+            continue;
+        }
+        memcpy(&header, p, sizeof(header));
+        const Site& site = it->second;
+        std::string msg;
+        if (ReadArgs(p + sizeof(header), end, args)) {
+            msg = Render(site.fmt, args);
+        }
+        else {
+            msg = "<bad arguments> " + site.fmt;
+        }
+        LogEvent::ptr event(new LogEvent(logger, site.level, site.file.c_str(), site.line,
+                                         header.thread_id, header.fiber_id, 0,
+                                         header.time / 1000000, header.time % 1000000));
+        // the record has no thread name, not the decoder's own
+        event->setThreadName("-");
+        event->getSS() << msg;
+        out.clear();
+        formatter->format(out, logger, event);
+        fwrite(out.data(), 1, out.size(), stdout);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    std::string pattern;
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) {
+            pattern = argv[++i];
+        }
+        else {
+            files.push_back(argv[i]);
+        }
+    }
+    LogFormatter::ptr formatter(new LogFormatter(pattern));
+    if (formatter->isError()) {
+        std::cerr << "sylar_logdecode: invalid pattern " << pattern << std::endl;
+        return 1;
+    }
+    if (files.empty()) {
+        std::string data((std::istreambuf_iterator<char>(std::cin)), std::istreambuf_iterator<char>());
+        Decode(data, formatter);
+    }
+    for (auto& file : files) {
+        std::ifstream ifs(file, std::ios::binary);
+        if (!ifs) {
+            std::cerr << "sylar_logdecode: cannot open " << file << std::endl;
+            return 1;
+        }
+        std::string data((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        Decode(data, formatter);
+    }
+    return 0;
+}